@@ -22,6 +22,7 @@
 #define HELIX_PROFILER_THREAD(name) tracy::SetThreadName(name)
 #define HELIX_PROFILER_FRAME(name) FrameMarkNamed(name)
 #define HELIX_PROFILER_ZONE_TEXT(text, length) ZoneText(text, length)
+#define HELIX_PROFILER_PLOT(name, value) TracyPlot(name, value)
 
 #else
 #define HELIX_PROFILER_COLOR_DEFAULT
@@ -39,4 +40,5 @@
 #define HELIX_PROFILER_THREAD(name)
 #define HELIX_PROFILER_FRAME(name)
 #define HELIX_PROFILER_ZONE_TEXT(text, length)
+#define HELIX_PROFILER_PLOT(name, value)
 #endif
@@ -0,0 +1,280 @@
+#include "AdaptiveBroadPhase.hpp"
+#include "LinearBVH.hpp"
+#include <Assert.hpp>
+#include <Log.hpp>
+#include <Profiler.hpp>
+#include <chrono>
+
+std::unique_ptr<BroadPhaseInterface>
+CreateBroadPhase(const BroadPhaseMode mode) {
+  switch (mode) {
+  case BroadPhaseMode::SweepAndPrune:
+    return std::make_unique<SweepAndPrune>();
+  case BroadPhaseMode::IncrementalSweepAndPrune:
+    return std::make_unique<IncrementalSweepAndPrune>();
+  case BroadPhaseMode::DynamicTree:
+    return std::make_unique<DynamicTreeBroadPhase>();
+  case BroadPhaseMode::SpatialHashGrid:
+    return std::make_unique<SpatialHashGrid>();
+  case BroadPhaseMode::HierarchicalGrid:
+    return std::make_unique<HierarchicalGrid>();
+  case BroadPhaseMode::LinearBVH:
+    return std::make_unique<LinearBVH>();
+  default:
+    HASSERT(false);
+    return nullptr;
+  }
+}
+
+f32 EstimateBroadPhaseCost(const BroadPhaseMode mode,
+                           const BroadPhaseStats &stats) {
+  const f32 n = (f32)stats.numDynamic;
+  if (n < 2.f) {
+    return n;
+  }
+  const f32 logN = log2f(n);
+
+  switch (mode) {
+  case BroadPhaseMode::SweepAndPrune:
+    return n * 120.f + stats.sweepPairs * 0.9f + stats.largePairs * 20.f;
+  case BroadPhaseMode::IncrementalSweepAndPrune: {
+    // The insertion sort swaps every endpoint a body moved past, and each swap
+    // past another body's endpoint adds or removes a pair from the hash table
+    const f32 relativeMotion =
+        glm::min(stats.meanMotion / glm::max(stats.meanExtent, 1e-6f), 1.f);
+    return n * 150.f + stats.sweepPairs * relativeMotion * 150.f;
+  }
+  case BroadPhaseMode::DynamicTree: {
+    // Proxies are re-inserted once they leave their 0.1 fat margin
+    const f32 reinserted = glm::min(stats.meanMotion / 0.1f, 1.f);
+    return n * logN * (28.f + reinserted * 80.f) + stats.largePairs * 250.f;
+  }
+  case BroadPhaseMode::SpatialHashGrid:
+    // Large bodies are tested against every other body
+    return n * (150.f + logN * 30.f) + stats.largeFraction * n * n * 15.f;
+  case BroadPhaseMode::HierarchicalGrid:
+    // Mixed sizes spread the bodies over more levels to check
+    return n * (100.f + logN * 20.f) + n * stats.extentVariation * 200.f +
+           stats.largePairs * 150.f;
+  case BroadPhaseMode::LinearBVH:
+    return n * (250.f + logN * 20.f) + stats.largePairs * 100.f;
+  default:
+    return 0.f;
+  }
+}
+
+f32 EstimateBroadPhasePairs(const BroadPhaseMode mode,
+                            const BroadPhaseStats &stats) {
+  // The incremental sweep reports every pair overlapping on its axis, the
+  // others only pairs whose bounds overlap
+  return mode == BroadPhaseMode::IncrementalSweepAndPrune ? stats.sweepPairs
+                                                          : stats.overlapPairs;
+}
+
+AdaptiveBroadPhase::AdaptiveBroadPhase() {
+  m_pActive = CreateBroadPhase(m_ActiveMode);
+}
+
+void AdaptiveBroadPhase::Clear() {
+  // The cost scales describe the machine more than the scene, so they stay
+  m_pActive->Clear();
+  m_StepsSinceSelect = kSelectInterval;
+  m_StepsSinceSwitch = 0;
+}
+
+void AdaptiveBroadPhase::SetMode(const BroadPhaseMode mode) {
+  m_Mode = mode;
+  if (mode == BroadPhaseMode::Auto) {
+    m_StepsSinceSelect = kSelectInterval;
+  } else {
+    SetActiveMode(mode);
+  }
+}
+
+void AdaptiveBroadPhase::SetActiveMode(const BroadPhaseMode mode) {
+  if (mode == m_ActiveMode) {
+    return;
+  }
+  m_ActiveMode = mode;
+  m_pActive = CreateBroadPhase(mode);
+  m_StepsSinceSwitch = 0;
+}
+
+void AdaptiveBroadPhase::Update(const Body *bodies, const i32 num,
+                                const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  const bool isAuto = m_Mode == BroadPhaseMode::Auto;
+  if (isAuto && ++m_StepsSinceSelect >= kSelectInterval) {
+    m_StepsSinceSelect = 0;
+    GatherStats(bodies, num, dt_sec);
+    SelectMode();
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  m_pActive->Update(bodies, num, dt_sec);
+  const f32 elapsed = std::chrono::duration<f32, std::nano>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+
+  // The first step after a switch builds everything from scratch and says
+  // little about the steps after it
+  if (!isAuto || m_StepsSinceSwitch++ == 0) {
+    return;
+  }
+  const f32 estimate = EstimateBroadPhaseCost(m_ActiveMode, m_Stats);
+  if (estimate > 0.f) {
+    f32 &scale = m_CostScales[(i32)m_ActiveMode];
+    const f32 ratio = elapsed / estimate;
+    scale = scale == 0.f ? ratio : scale * 0.9f + ratio * 0.1f;
+  }
+}
+
+void AdaptiveBroadPhase::GatherStats(const Body *bodies, const i32 num,
+                                     const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  BroadPhaseStats &stats = m_Stats;
+  stats = {};
+  stats.numBodies = num;
+
+  m_Centers.clear();
+  m_Extents.clear();
+  Bounds centerBounds;
+  Vec3 sumSize(0.f);
+  f32 sumExtent2 = 0.f;
+  f32 sumMotion = 0.f;
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      continue;
+    }
+    const Bounds bounds = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    const Vec3 size = bounds.maxs - bounds.mins;
+    const f32 extent = glm::max(glm::max(size.x, size.y), size.z);
+    m_Centers.push_back((bounds.mins + bounds.maxs) * 0.5f);
+    m_Extents.push_back(extent);
+    centerBounds.Expand(m_Centers.back());
+    sumSize += size;
+    stats.meanExtent += extent;
+    sumExtent2 += extent * extent;
+    sumMotion += glm::length(bodies[i].linearVelocity) * dt_sec;
+  }
+  stats.numDynamic = (i32)m_Centers.size();
+  stats.staticFraction = num > 0 ? (f32)(num - stats.numDynamic) / num : 0.f;
+  if (stats.numDynamic == 0) {
+    return;
+  }
+
+  const f32 numDynamic = (f32)stats.numDynamic;
+  stats.meanExtent /= numDynamic;
+  stats.meanMotion = sumMotion / numDynamic;
+  const f32 variance = glm::max(
+      sumExtent2 / numDynamic - stats.meanExtent * stats.meanExtent, 0.f);
+  stats.extentVariation = sqrtf(variance) / glm::max(stats.meanExtent, 1e-6f);
+  i32 numLarge = 0;
+  for (const f32 extent : m_Extents) {
+    numLarge += extent > stats.meanExtent * 2.f;
+  }
+  stats.largeFraction = numLarge / numDynamic;
+
+  // Bucket the centers into cells of the mean extent. Bounds overlap when
+  // their centers are less than one extent apart on every axis, which covers
+  // about 8 cells, so each body overlaps about 8 times as many bodies as share
+  // its cell
+  const f32 invCellSize = 1.f / glm::max(stats.meanExtent, 1e-3f);
+  constexpr i32 kMaxCoord = (1 << 21) - 1;
+  m_CellCounts.Clear();
+  for (const Vec3 &center : m_Centers) {
+    const glm::ivec3 coord = glm::clamp(
+        glm::ivec3(glm::floor((center - centerBounds.mins) * invCellSize)), 0,
+        kMaxCoord);
+    const u64 key =
+        (u64)coord.x | ((u64)coord.y << 21) | ((u64)coord.z << 42);
+    m_CellCounts.Set(key, glm::max(m_CellCounts.Find(key), 0) + 1);
+  }
+  f32 sharedCells = 0.f;
+  m_CellCounts.ForEach([&sharedCells](const u64, const i32 count) {
+    sharedCells += (f32)count * (count - 1);
+  });
+
+  // Large bodies reach well past the neighbouring cells, count the bodies
+  // expected inside their reach from the mean density instead
+  const Vec3 volume = centerBounds.maxs - centerBounds.mins +
+                      Vec3(stats.meanExtent);
+  const f32 density = numDynamic / (volume.x * volume.y * volume.z);
+  for (const f32 extent : m_Extents) {
+    if (extent > stats.meanExtent * 2.f) {
+      const f32 reach = extent + stats.meanExtent;
+      stats.largePairs += density * reach * reach * reach;
+    }
+  }
+  stats.overlapPairs = sharedCells * 4.f + stats.largePairs;
+
+  // Histogram of the centers along the longest axis in bins of the mean size
+  // on that axis. Bodies in the same bin overlap on the axis, bodies in
+  // neighbouring bins do about half the time
+  const Vec3 span = centerBounds.maxs - centerBounds.mins;
+  i32 axis = 0;
+  if (span.y > span[axis]) {
+    axis = 1;
+  }
+  if (span.z > span[axis]) {
+    axis = 2;
+  }
+  const f32 meanSize = glm::max(sumSize[axis] / numDynamic, 1e-6f);
+  const i32 numBins = (i32)glm::min(span[axis] / meanSize + 1.f,
+                                    numDynamic * 4.f);
+  const f32 binSize = glm::max(meanSize, span[axis] / numBins);
+  m_AxisHistogram.assign(numBins + 1, 0);
+  for (const Vec3 &center : m_Centers) {
+    const i32 bin = (i32)((center[axis] - centerBounds.mins[axis]) / binSize);
+    m_AxisHistogram[glm::clamp(bin, 0, numBins - 1)]++;
+  }
+  f32 sweepPairs = 0.f;
+  for (i32 bin = 0; bin < numBins; bin++) {
+    const f32 count = (f32)m_AxisHistogram[bin];
+    sweepPairs += count * (count - 1.f + m_AxisHistogram[bin + 1]) * 0.5f;
+  }
+  // Bins wider than the bodies only overlap that share of the time
+  sweepPairs *= meanSize / binSize;
+  const f32 evenSweepPairs =
+      numDynamic * numDynamic * meanSize / glm::max(span[axis], meanSize);
+  stats.clustering =
+      glm::max(1.f - evenSweepPairs / glm::max(sweepPairs, 1.f), 0.f);
+  // The sweeps use the principal axis, which is often diagonal, where the
+  // bounds project about half again as long
+  stats.sweepPairs = sweepPairs * 1.5f;
+}
+
+f32 AdaptiveBroadPhase::GetCostScale(const BroadPhaseMode mode) const {
+  // Algorithms that have not run yet are taken at the model's word. If it
+  // favours one wrongly, it gets measured once it runs and loses its place
+  return m_CostScales[(i32)mode] > 0.f ? m_CostScales[(i32)mode] : 1.f;
+}
+
+void AdaptiveBroadPhase::SelectMode() {
+  f32 costs[kNumAlgorithms];
+  i32 best = 0;
+  for (i32 i = 0; i < kNumAlgorithms; i++) {
+    const BroadPhaseMode mode = (BroadPhaseMode)i;
+    costs[i] = EstimateBroadPhaseCost(mode, m_Stats) * GetCostScale(mode) +
+               EstimateBroadPhasePairs(mode, m_Stats) * kPairCost;
+    if (costs[i] < costs[best]) {
+      best = i;
+    }
+  }
+  HELIX_PROFILER_PLOT("Broadphase Estimated Cost",
+                      (i64)costs[(i32)m_ActiveMode]);
+
+  const i32 active = (i32)m_ActiveMode;
+  if (best == active || costs[best] >= costs[active] * kSwitchRatio) {
+    return;
+  }
+  HINFO("BroadPhase: switching from {} to {}, estimated {:.1f} us -> {:.1f} "
+        "us ({} bodies, {:.0f}% static, extent variation {:.2f}, clustering "
+        "{:.2f})",
+        BroadPhaseModeName(m_ActiveMode),
+        BroadPhaseModeName((BroadPhaseMode)best), costs[active] * 0.001f,
+        costs[best] * 0.001f, m_Stats.numBodies,
+        m_Stats.staticFraction * 100.f, m_Stats.extentVariation,
+        m_Stats.clustering);
+  SetActiveMode((BroadPhaseMode)best);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Broadphase.hpp"
+#include "PairHashTable.hpp"
+#include <memory>
+
+// Shape of the dynamic part of a scene, as seen by the broadphase cost model
+struct BroadPhaseStats {
+  i32 numBodies;
+  i32 numDynamic;
+  f32 staticFraction;
+  f32 meanExtent;      // Largest side of the swept bounds
+  f32 extentVariation; // Standard deviation of the extents over their mean
+  f32 largeFraction;   // Bodies more than twice the mean extent
+  // 0 when the bodies are spread evenly along the sweep axis, approaching 1 as
+  // they bunch up and produce more sweep candidates than an even spread would
+  f32 clustering;
+  f32 sweepPairs;   // Pairs whose bounds overlap along the sweep axis
+  f32 overlapPairs; // Pairs whose bounds overlap
+  f32 largePairs;   // Overlapping pairs with a large body in them
+  f32 meanMotion;   // Mean distance moved per step
+};
+
+// New, empty broadphase of the given algorithm. mode must not be Auto
+std::unique_ptr<BroadPhaseInterface> CreateBroadPhase(const BroadPhaseMode mode);
+
+// Rough Update time of an algorithm in nanoseconds, from per-body costs of the
+// passes it runs and the candidate counts the stats predict. Fitted to single
+// threaded runs of uniform, clustered and mixed size scenes of 200 to 50k
+// bodies
+f32 EstimateBroadPhaseCost(const BroadPhaseMode mode,
+                           const BroadPhaseStats &stats);
+// Pairs an algorithm hands to the narrowphase
+f32 EstimateBroadPhasePairs(const BroadPhaseMode mode,
+                            const BroadPhaseStats &stats);
+
+/*
+====================================================
+AdaptiveBroadPhase
+
+Owns the active broadphase algorithm. With a fixed mode it just forwards to it.
+In Auto mode it gathers BroadPhaseStats every kSelectInterval steps, estimates
+the cost of every algorithm, including the pairs it leaves to the narrowphase,
+and switches when another one is expected to be clearly cheaper, logging each
+switch. The Update estimate of an algorithm that has run is scaled by the ratio
+of its measured to estimated time, so the model corrects itself for the machine
+and the scene as it goes.
+====================================================
+*/
+class AdaptiveBroadPhase : public BroadPhaseInterface {
+public:
+  AdaptiveBroadPhase();
+
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_pActive->GetPairs();
+  }
+  u32 GetSortedEndpoints() const override {
+    return m_pActive->GetSortedEndpoints();
+  }
+
+  // A fixed algorithm or Auto
+  void SetMode(const BroadPhaseMode mode);
+  BroadPhaseMode GetMode() const { return m_Mode; }
+  // Algorithm run by the last Update
+  BroadPhaseMode GetActiveMode() const { return m_ActiveMode; }
+  // Stats from the last time Auto mode looked at the scene
+  const BroadPhaseStats &GetStats() const { return m_Stats; }
+
+private:
+  void GatherStats(const Body *bodies, const i32 num, const f32 dt_sec);
+  void SelectMode();
+  void SetActiveMode(const BroadPhaseMode mode);
+  f32 GetCostScale(const BroadPhaseMode mode) const;
+
+private:
+  static constexpr i32 kNumAlgorithms = (i32)BroadPhaseMode::Auto;
+  static constexpr u32 kSelectInterval = 60;
+  // Another algorithm has to be estimated this much cheaper to switch to it
+  static constexpr f32 kSwitchRatio = 0.75f;
+  // Nanoseconds the pair cache and narrowphase spend on every pair
+  static constexpr f32 kPairCost = 40.f;
+
+  BroadPhaseMode m_Mode{BroadPhaseMode::Auto};
+  BroadPhaseMode m_ActiveMode{BroadPhaseMode::SweepAndPrune};
+  std::unique_ptr<BroadPhaseInterface> m_pActive;
+  u32 m_StepsSinceSelect{kSelectInterval};
+  u32 m_StepsSinceSwitch{0};
+
+  BroadPhaseStats m_Stats{};
+  std::vector<Vec3> m_Centers; // Dynamic bodies only
+  std::vector<f32> m_Extents;
+  PairHashTable m_CellCounts;
+  std::vector<u32> m_AxisHistogram;
+  // Measured over estimated step time per algorithm, 0 until it has run
+  f32 m_CostScales[kNumAlgorithms]{};
+};
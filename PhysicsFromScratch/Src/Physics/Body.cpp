@@ -90,6 +90,31 @@ void Body::Update(const f32 dt_Sec) {
                         glm::rotate(quatRotation, cmToWorldPos));
 }
 
+BodyPose Body::PredictPose(const f32 dt_Sec) const {
+  BodyPose pose;
+  pose.position = transform.GetPosition();
+  pose.orientation = transform.GetRotation();
+  pose.centerOfMass = GetCenterOfMassWorldSpace();
+  if (invMass == 0.f)
+    return pose;
+
+  // Same rotation as Update
+  Vec3 angleAxisRotation = angularVelocity * dt_Sec;
+  Vec3 angleAxisRotationNorm = Vec3(0.f);
+  if (glm::length2(angleAxisRotation) > 1e-6f)
+    angleAxisRotationNorm = glm::normalize(angleAxisRotation);
+  Quat quatRotation =
+      glm::angleAxis(glm::length(angleAxisRotation), angleAxisRotationNorm);
+  pose.orientation = glm::normalize(quatRotation * pose.orientation);
+
+  // The center of mass only moves linearly, the body turns around it
+  const Vec3 cmToWorldPos = pose.position - pose.centerOfMass;
+  pose.centerOfMass += linearVelocity * dt_Sec;
+  pose.position =
+      pose.centerOfMass + glm::rotate(quatRotation, cmToWorldPos);
+  return pose;
+}
+
 Mat3 Body::GetInertiaTensorBodySpace() const {
   return GetSphereInertiaTensor(this) * invMass;
 }
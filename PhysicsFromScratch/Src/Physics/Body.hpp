@@ -5,6 +5,13 @@
 
 const f32 gravity = 10.f;
 
+// Where a body is at some point in time, all in world space
+struct BodyPose {
+  Vec3 position;
+  Quat orientation;
+  Vec3 centerOfMass;
+};
+
 struct Body {
   Transform transform;
   Vec3 centerOfMass; // This is in local space
@@ -30,6 +37,10 @@ struct Body {
   void ApplyImpulseAngular(const Vec3 &impulse);
 
   void Update(const f32 dt_Sec);
+  // Pose after Update(dt_Sec), without changing the body. Leaves out the
+  // internal torque, which is zero for the sphere inertia tensor, so no
+  // inertia tensors are built
+  BodyPose PredictPose(const f32 dt_Sec) const;
 };
 
 inline Mat3 GetSphereInertiaTensor(const Body *body) {
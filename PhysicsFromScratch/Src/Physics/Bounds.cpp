@@ -16,6 +16,11 @@ bool Bounds::DoesIntersect(const Bounds &rhs) const {
   return true;
 }
 
+bool Bounds::Contains(const Bounds &rhs) const {
+  return mins.x <= rhs.mins.x && mins.y <= rhs.mins.y && mins.z <= rhs.mins.z &&
+         rhs.maxs.x <= maxs.x && rhs.maxs.y <= maxs.y && rhs.maxs.z <= maxs.z;
+}
+
 void Bounds::Expand(const Vec3 *pts, const i32 num) {
   for (i32 i = 0; i < num; i++) {
     Expand(pts[i]);
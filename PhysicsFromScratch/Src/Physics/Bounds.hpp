@@ -19,6 +19,7 @@ public:
   }
 
   bool DoesIntersect(const Bounds &rhs) const;
+  bool Contains(const Bounds &rhs) const;
   void Expand(const Vec3 *pts, const i32 num);
   void Expand(const Vec3 &rhs);
   void Expand(const Bounds &rhs);
@@ -0,0 +1,55 @@
+#include "BroadPhaseTelemetry.hpp"
+#include <Profiler.hpp>
+#include <cstdio>
+
+void BroadPhaseTelemetry::Record(const BroadPhaseCounters &counters) {
+  m_Last = counters;
+  m_Last.step = m_Step++;
+  const u32 numPairs = counters.candidatePairs + counters.staticPairs;
+  m_Last.falsePositiveRatio =
+      numPairs > 0 ? 1.f - (f32)counters.contacts / (f32)numPairs : 0.f;
+  if (m_Recording) {
+    m_History.push_back(m_Last);
+  }
+
+  HELIX_PROFILER_PLOT("Telemetry Bodies", (i64)m_Last.numBodies);
+  HELIX_PROFILER_PLOT("Telemetry Fused Sweep", (i64)m_Last.fused);
+  HELIX_PROFILER_PLOT("Telemetry Sorted Endpoints",
+                      (i64)m_Last.sortedEndpoints);
+  HELIX_PROFILER_PLOT("Telemetry Candidate Pairs", (i64)m_Last.candidatePairs);
+  HELIX_PROFILER_PLOT("Telemetry Static Pairs", (i64)m_Last.staticPairs);
+  HELIX_PROFILER_PLOT("Telemetry Skipped Static Pairs",
+                      (i64)m_Last.skippedStaticPairs);
+  HELIX_PROFILER_PLOT("Telemetry Tested Pairs", (i64)m_Last.testedPairs);
+  HELIX_PROFILER_PLOT("Telemetry Carried Pairs", (i64)m_Last.carriedPairs);
+  HELIX_PROFILER_PLOT("Telemetry Contacts", (i64)m_Last.contacts);
+  HELIX_PROFILER_PLOT("Telemetry False Positive Ratio",
+                      m_Last.falsePositiveRatio);
+}
+
+void BroadPhaseTelemetry::Clear() {
+  m_Last = {};
+  m_Step = 0;
+  m_History.clear();
+}
+
+bool BroadPhaseTelemetry::WriteCSV(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    return false;
+  }
+  fprintf(file, "step,algorithm,fused,bodies,static_bodies,sorted_endpoints,"
+                "candidate_pairs,static_pairs,skipped_static_pairs,"
+                "tested_pairs,carried_pairs,contacts,false_positive_ratio\n");
+  for (const BroadPhaseCounters &counters : m_History) {
+    fprintf(file, "%u,%s,%d,%d,%d,%u,%u,%u,%llu,%u,%u,%u,%f\n", counters.step,
+            BroadPhaseModeName(counters.mode), counters.fused ? 1 : 0,
+            counters.numBodies, counters.numStatic, counters.sortedEndpoints,
+            counters.candidatePairs, counters.staticPairs,
+            (unsigned long long)counters.skippedStaticPairs,
+            counters.testedPairs, counters.carriedPairs, counters.contacts,
+            counters.falsePositiveRatio);
+  }
+  fclose(file);
+  return true;
+}
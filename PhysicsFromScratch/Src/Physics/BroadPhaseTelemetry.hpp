@@ -0,0 +1,60 @@
+#pragma once
+#include "Broadphase.hpp"
+#include <vector>
+
+// What the broadphase handed to the narrowphase in one step and how much of
+// it turned into contacts
+struct BroadPhaseCounters {
+  u32 step;
+  BroadPhaseMode mode; // Algorithm that ran, never Auto
+  // The sweep ran the sphere tests itself in SphereContactSweep, mode is then
+  // SweepAndPrune and testedPairs are all of its candidates
+  bool fused;
+  i32 numBodies;
+  i32 numStatic;
+  u32 sortedEndpoints; // Interval endpoints sorted, 0 for non-sweep algorithms
+  u32 candidatePairs;  // Dynamic-dynamic pairs from the per-frame broadphase
+  u32 staticPairs;     // Dynamic-static pairs from the StaticBroadPhase
+  u64 skippedStaticPairs; // Static-static pairs that were never generated
+  u32 testedPairs;        // Pairs that reached the narrowphase test
+  // Touching pairs that skipped the test because their manifold carried over
+  u32 carriedPairs;
+  u32 contacts; // Pairs that passed the test, plus the carried pairs
+  // Share of the candidate and static pairs that did not become a contact
+  f32 falsePositiveRatio;
+};
+
+/*
+====================================================
+BroadPhaseTelemetry
+
+Per-step BroadPhaseCounters. Record publishes them as Tracy plots and keeps the
+latest ones. While recording is on every step is also appended to a history,
+so headless runs can compare algorithms over a whole simulation and dump it
+with WriteCSV.
+====================================================
+*/
+class BroadPhaseTelemetry {
+public:
+  // Fills in the step index and the false positive ratio
+  void Record(const BroadPhaseCounters &counters);
+  void Clear();
+
+  const BroadPhaseCounters &GetLast() const { return m_Last; }
+
+  void SetRecording(const bool recording) { m_Recording = recording; }
+  bool IsRecording() const { return m_Recording; }
+  const std::vector<BroadPhaseCounters> &GetHistory() const {
+    return m_History;
+  }
+
+  // One row per recorded step after a header row. Returns false if the file
+  // could not be opened
+  bool WriteCSV(const char *path) const;
+
+private:
+  BroadPhaseCounters m_Last{};
+  u32 m_Step{0};
+  bool m_Recording{false};
+  std::vector<BroadPhaseCounters> m_History;
+};
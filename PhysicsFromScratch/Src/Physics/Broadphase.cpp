@@ -1,95 +1,1247 @@
 #include "Broadphase.hpp"
+#include "Intersections.hpp"
+#include "ParallelBuffers.hpp"
+#include "RadixSort.hpp"
 #include <Profiler.hpp>
+#include <algorithm>
+#include <immintrin.h>
+#include <limits>
+#include <omp.h>
 
-struct PsuedoBody {
-  i32 id;
-  f32 value;
-  bool ismin;
-};
+const char *BroadPhaseModeName(const BroadPhaseMode mode) {
+  switch (mode) {
+  case BroadPhaseMode::SweepAndPrune:
+    return "Sweep And Prune";
+  case BroadPhaseMode::IncrementalSweepAndPrune:
+    return "Incremental Sweep And Prune";
+  case BroadPhaseMode::DynamicTree:
+    return "Dynamic AABB Tree";
+  case BroadPhaseMode::SpatialHashGrid:
+    return "Spatial Hash Grid";
+  case BroadPhaseMode::HierarchicalGrid:
+    return "Hierarchical Grid";
+  case BroadPhaseMode::LinearBVH:
+    return "Linear BVH";
+  case BroadPhaseMode::Auto:
+    return "Auto";
+  default:
+    return "Unknown";
+  }
+}
+
+Bounds GetBroadPhaseBounds(const Body *body, const f32 dt_sec) {
+  Bounds bounds = GetSphereBounds(body, body->transform.GetPosition(),
+                                  body->transform.GetRotation());
+
+  // Expand the bounds by the linear velocity
+  bounds.Expand(bounds.mins + body->linearVelocity * dt_sec);
+  bounds.Expand(bounds.maxs + body->linearVelocity * dt_sec);
+
+  const f32 epsilon = 0.01f;
+  bounds.Expand(bounds.mins + Vec3(-1, -1, -1) * epsilon);
+  bounds.Expand(bounds.maxs + Vec3(1, 1, 1) * epsilon);
+  return bounds;
+}
+
+// Most power iterations spent on the sweep axis, they stop early once the axis
+// turns by less than kSweepAxisConverged
+static constexpr i32 kSweepAxisIterations = 32;
+static constexpr f32 kSweepAxisConverged = 0.99999f;
+// Covariance image this small next to the trace means no spread at all
+static constexpr f32 kSweepAxisDegenerate = 1e-12f;
 
-i32 CompareSAP(const void *a, const void *b) {
-  const PsuedoBody *ea = (const PsuedoBody *)a;
-  const PsuedoBody *eb = (const PsuedoBody *)b;
+Vec3 ChooseSweepAxis(const Body *bodies, const i32 num) {
+  const Vec3 defaultAxis = glm::normalize(Vec3(1, 1, 1));
+  if (num < 2) {
+    return defaultAxis;
+  }
 
-  if (ea->value < eb->value) {
-    return -1;
+  Vec3 mean(0.f);
+  i32 numDynamic = 0;
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i])) {
+      mean += bodies[i].transform.GetPosition();
+      numDynamic++;
+    }
   }
-  return 1;
+  if (numDynamic < 2) {
+    return defaultAxis;
+  }
+  mean /= (f32)numDynamic;
+
+  Mat3 covariance(0.f);
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      continue;
+    }
+    const Vec3 d = bodies[i].transform.GetPosition() - mean;
+    covariance += glm::outerProduct(d, d);
+  }
+
+  // All bodies share the same center, any axis is as good as another
+  const f32 trace = covariance[0][0] + covariance[1][1] + covariance[2][2];
+  if (trace <= 0.f) {
+    return defaultAxis;
+  }
+
+  // Power iteration for the eigenvector with the largest eigenvalue. It starts
+  // from the covariance column of the most spread out world axis, which always
+  // has a share of the spread, where a fixed start can be perpendicular to it
+  i32 column = 0;
+  for (i32 i = 1; i < 3; i++) {
+    if (covariance[i][i] > covariance[column][column]) {
+      column = i;
+    }
+  }
+  Vec3 axis = glm::normalize(covariance[column]);
+  for (i32 i = 0; i < kSweepAxisIterations; i++) {
+    const Vec3 next = covariance * axis;
+    const f32 lengthSq = glm::length2(next);
+    // Measured against the trace so the test does not depend on scene scale
+    if (lengthSq <= kSweepAxisDegenerate * trace * trace) {
+      return defaultAxis;
+    }
+    const Vec3 previous = axis;
+    axis = next / sqrtf(lengthSq);
+    if (glm::dot(axis, previous) > kSweepAxisConverged) {
+      break;
+    }
+  }
+  return axis;
 }
 
-void SortBodiesBounds(const Body *bodies, const i32 num,
-                      PsuedoBody *sortedArray, const f32 dt_sec) {
-  Vec3 axis = glm::normalize(Vec3(1, 1, 1));
+// Projects the bounds onto the axis. The axis can point into any octant, so the
+// corner used for each end is picked per component
+static inline void ProjectBounds(const Bounds &bounds, const Vec3 &axis,
+                                 f32 &minValue, f32 &maxValue) {
+  const Vec3 lo(axis.x >= 0.f ? bounds.mins.x : bounds.maxs.x,
+                axis.y >= 0.f ? bounds.mins.y : bounds.maxs.y,
+                axis.z >= 0.f ? bounds.mins.z : bounds.maxs.z);
+  const Vec3 hi(axis.x >= 0.f ? bounds.maxs.x : bounds.mins.x,
+                axis.y >= 0.f ? bounds.maxs.y : bounds.mins.y,
+                axis.z >= 0.f ? bounds.maxs.z : bounds.mins.z);
+  minValue = glm::dot(axis, lo);
+  maxValue = glm::dot(axis, hi);
+}
+
+// Below this many bodies the worker threads cost more than they save
+static constexpr i32 kParallelSweepMinBodies = 2048;
+
+void SweepBounds::Resize(const i32 num) {
+  ids.resize(num);
+  endRanks.resize(num);
+  minX.resize(num);
+  minY.resize(num);
+  minZ.resize(num);
+  maxX.resize(num);
+  maxY.resize(num);
+  maxZ.resize(num);
+}
 
+void SortBodiesBounds(const Body *bodies, const i32 *ids, const i32 num,
+                      const Vec3 &axis, PsuedoBody *sortedArray,
+                      PsuedoBody *scratch, Bounds *bodyBounds,
+                      const f32 dt_sec) {
+#pragma omp parallel for if (num >= kParallelSweepMinBodies)
   for (i32 i = 0; i < num; i++) {
-    const Body *body = &bodies[i];
-    Bounds bounds = GetSphereBounds(body, body->transform.GetPosition(),
-                                    body->transform.GetRotation());
+    const i32 id = ids[i];
+    const Bounds bounds = GetBroadPhaseBounds(&bodies[id], dt_sec);
+    bodyBounds[id] = bounds;
+
+    // All min endpoints go before the max endpoints. The radix sort is stable,
+    // so touching intervals keep their min first and are still reported
+    f32 minValue, maxValue;
+    ProjectBounds(bounds, axis, minValue, maxValue);
+
+    sortedArray[i].id = id;
+    sortedArray[i].value = minValue;
+    sortedArray[i].ismin = true;
+
+    sortedArray[num + i].id = id;
+    sortedArray[num + i].value = maxValue;
+    sortedArray[num + i].ismin = false;
+  }
+
+  // Sort the endpoints along the axis. The float projections are mapped onto
+  // order preserving integer keys so a radix sort can be used instead of a
+  // comparison sort
+  RadixSort(sortedArray, scratch, num * 2, [](const PsuedoBody &endpoint) {
+    return FloatToSortableKey(endpoint.value);
+  });
+}
+
+void BuildSweepBounds(const PsuedoBody *sortedBodies, const Bounds *bodyBounds,
+                      const i32 num, std::vector<i32> &ranks,
+                      SweepBounds &sweep) {
+  sweep.Resize(num);
+
+  i32 rank = 0;
+  for (i32 i = 0; i < num * 2; i++) {
+    const PsuedoBody &endpoint = sortedBodies[i];
+    if (!endpoint.ismin) {
+      // Every body that started before this max overlaps it on the axis
+      sweep.endRanks[ranks[endpoint.id]] = rank;
+      continue;
+    }
+
+    const Bounds &bounds = bodyBounds[endpoint.id];
+    ranks[endpoint.id] = rank;
+    sweep.ids[rank] = endpoint.id;
+    sweep.minX[rank] = bounds.mins.x;
+    sweep.minY[rank] = bounds.mins.y;
+    sweep.minZ[rank] = bounds.mins.z;
+    sweep.maxX[rank] = bounds.maxs.x;
+    sweep.maxY[rank] = bounds.maxs.y;
+    sweep.maxZ[rank] = bounds.maxs.z;
+    rank++;
+  }
+}
 
-    // Expand the bounds by the linear velocity
-    bounds.Expand(bounds.mins + body->linearVelocity * dt_sec);
-    bounds.Expand(bounds.maxs + body->linearVelocity * dt_sec);
+// Tests the bounds at rank against the candidates in [begin, end) on all three
+// axes and calls visitor(i32 bodyId) for every candidate that overlaps
+template <typename T>
+static void SweepRank(const SweepBounds &sweep, const i32 rank, i32 begin,
+                      const i32 end, T &&visitor) {
+  const f32 *minX = sweep.minX.data();
+  const f32 *minY = sweep.minY.data();
+  const f32 *minZ = sweep.minZ.data();
+  const f32 *maxX = sweep.maxX.data();
+  const f32 *maxY = sweep.maxY.data();
+  const f32 *maxZ = sweep.maxZ.data();
 
-    const f32 epsilon = 0.01f;
-    bounds.Expand(bounds.mins + Vec3(-1, -1, -1) * epsilon);
-    bounds.Expand(bounds.maxs + Vec3(1, 1, 1) * epsilon);
+#if defined(__AVX2__)
+  const __m256 aMinX = _mm256_set1_ps(minX[rank]);
+  const __m256 aMinY = _mm256_set1_ps(minY[rank]);
+  const __m256 aMinZ = _mm256_set1_ps(minZ[rank]);
+  const __m256 aMaxX = _mm256_set1_ps(maxX[rank]);
+  const __m256 aMaxY = _mm256_set1_ps(maxY[rank]);
+  const __m256 aMaxZ = _mm256_set1_ps(maxZ[rank]);
+  for (; begin + 8 <= end; begin += 8) {
+    __m256 overlap =
+        _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minX + begin), aMaxX,
+                                    _CMP_LE_OQ),
+                      _mm256_cmp_ps(aMinX, _mm256_loadu_ps(maxX + begin),
+                                    _CMP_LE_OQ));
+    overlap = _mm256_and_ps(
+        overlap, _mm256_cmp_ps(_mm256_loadu_ps(minY + begin), aMaxY,
+                               _CMP_LE_OQ));
+    overlap = _mm256_and_ps(
+        overlap, _mm256_cmp_ps(aMinY, _mm256_loadu_ps(maxY + begin),
+                               _CMP_LE_OQ));
+    overlap = _mm256_and_ps(
+        overlap, _mm256_cmp_ps(_mm256_loadu_ps(minZ + begin), aMaxZ,
+                               _CMP_LE_OQ));
+    overlap = _mm256_and_ps(
+        overlap, _mm256_cmp_ps(aMinZ, _mm256_loadu_ps(maxZ + begin),
+                               _CMP_LE_OQ));
 
-    sortedArray[i * 2 + 0].id = i;
-    sortedArray[i * 2 + 0].value = glm::dot(axis, bounds.mins);
-    sortedArray[i * 2 + 0].ismin = true;
+    u32 mask = (u32)_mm256_movemask_ps(overlap);
+    for (u32 lane = 0; mask != 0; lane++, mask >>= 1) {
+      if (mask & 1) {
+        visitor(sweep.ids[begin + lane]);
+      }
+    }
+  }
+#else
+  const __m128 aMinX = _mm_set1_ps(minX[rank]);
+  const __m128 aMinY = _mm_set1_ps(minY[rank]);
+  const __m128 aMinZ = _mm_set1_ps(minZ[rank]);
+  const __m128 aMaxX = _mm_set1_ps(maxX[rank]);
+  const __m128 aMaxY = _mm_set1_ps(maxY[rank]);
+  const __m128 aMaxZ = _mm_set1_ps(maxZ[rank]);
+  for (; begin + 4 <= end; begin += 4) {
+    __m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minX + begin), aMaxX),
+                                _mm_cmple_ps(aMinX, _mm_loadu_ps(maxX + begin)));
+    overlap =
+        _mm_and_ps(overlap, _mm_cmple_ps(_mm_loadu_ps(minY + begin), aMaxY));
+    overlap =
+        _mm_and_ps(overlap, _mm_cmple_ps(aMinY, _mm_loadu_ps(maxY + begin)));
+    overlap =
+        _mm_and_ps(overlap, _mm_cmple_ps(_mm_loadu_ps(minZ + begin), aMaxZ));
+    overlap =
+        _mm_and_ps(overlap, _mm_cmple_ps(aMinZ, _mm_loadu_ps(maxZ + begin)));
 
-    sortedArray[i * 2 + 1].id = i;
-    sortedArray[i * 2 + 1].value = glm::dot(axis, bounds.maxs);
-    sortedArray[i * 2 + 1].ismin = false;
+    u32 mask = (u32)_mm_movemask_ps(overlap);
+    for (u32 lane = 0; mask != 0; lane++, mask >>= 1) {
+      if (mask & 1) {
+        visitor(sweep.ids[begin + lane]);
+      }
+    }
   }
+#endif // __AVX2__
 
-  qsort(sortedArray, num * 2, sizeof(PsuedoBody), CompareSAP);
+  // Leftover candidates that do not fill a whole register
+  for (; begin < end; begin++) {
+    if (minX[begin] <= maxX[rank] && minX[rank] <= maxX[begin] &&
+        minY[begin] <= maxY[rank] && minY[rank] <= maxY[begin] &&
+        minZ[begin] <= maxZ[rank] && minZ[rank] <= maxZ[begin]) {
+      visitor(sweep.ids[begin]);
+    }
+  }
+}
+
+// Appends a pair for every candidate overlapping the body at rank
+static void SweepRankPairs(const SweepBounds &sweep, const i32 rank,
+                           std::vector<CollisionPair> &pairs) {
+  CollisionPair pair;
+  pair.a = sweep.ids[rank];
+  SweepRank(sweep, rank, rank + 1, sweep.endRanks[rank], [&](const i32 id) {
+    pair.b = id;
+    pairs.push_back(pair);
+  });
 }
 
 void BuildPairs(std::vector<CollisionPair> &collisionPairs,
-                const PsuedoBody *sortedBodies, const i32 num) {
+                const SweepBounds &sweep, const i32 num) {
   collisionPairs.clear();
 
-  // Now that the bodies are sorted, build the collision pairs
-  for (i32 i = 0; i < num * 2; i++) {
-    const PsuedoBody &a = sortedBodies[i];
-    if (!a.ismin) {
+  // Now that the bodies are sorted, every body only has to be tested against
+  // the bodies that start before its max endpoint. The sweep axis only gives
+  // candidates, the full bounds test rejects the ones that miss on the other
+  // axes before they reach the narrowphase
+  for (i32 rank = 0; rank < num; rank++) {
+    SweepRankPairs(sweep, rank, collisionPairs);
+  }
+}
+
+// Splits the ranks into numChunks chunks with roughly the same number of
+// candidates, bodies piled up on the sweep axis have far more of them than the
+// rest. chunkStarts gets numChunks + 1 entries
+static void SplitSweepRanks(const SweepBounds &sweep, const i32 num,
+                            const i32 numChunks, std::vector<u64> &workPrefix,
+                            std::vector<i32> &chunkStarts) {
+  workPrefix.resize(num + 1);
+  workPrefix[0] = 0;
+  for (i32 rank = 0; rank < num; rank++) {
+    workPrefix[rank + 1] =
+        workPrefix[rank] + (u64)(sweep.endRanks[rank] - rank);
+  }
+  chunkStarts.resize(numChunks + 1);
+  for (i32 chunk = 0; chunk < numChunks; chunk++) {
+    const u64 target = workPrefix[num] * chunk / numChunks;
+    chunkStarts[chunk] = (i32)(std::lower_bound(workPrefix.begin(),
+                                                workPrefix.begin() + num,
+                                                target) -
+                               workPrefix.begin());
+  }
+  chunkStarts[numChunks] = num;
+}
+
+// workPrefix, chunkStarts and chunkPairs are scratch owned by the caller
+void BuildPairsParallel(std::vector<CollisionPair> &collisionPairs,
+                        const SweepBounds &sweep, const i32 num,
+                        std::vector<u64> &workPrefix,
+                        std::vector<i32> &chunkStarts,
+                        std::vector<std::vector<CollisionPair>> &chunkPairs) {
+  // There are a few chunks per thread so the dynamic schedule can balance out
+  // what the work estimate misses
+  const i32 numChunks = omp_get_max_threads() * 4;
+  SplitSweepRanks(sweep, num, numChunks, workPrefix, chunkStarts);
+
+  // Each chunk sweeps into its own buffer, so no thread touches another's
+  // pairs and the result does not depend on which thread ran which chunk
+  chunkPairs.resize(numChunks);
+#pragma omp parallel for schedule(dynamic, 1)
+  for (i32 chunk = 0; chunk < numChunks; chunk++) {
+    std::vector<CollisionPair> &pairs = chunkPairs[chunk];
+    pairs.clear();
+    for (i32 rank = chunkStarts[chunk]; rank < chunkStarts[chunk + 1];
+         rank++) {
+      SweepRankPairs(sweep, rank, pairs);
+    }
+  }
+
+  // Concatenating the chunks in rank order gives exactly the serial output
+  ConcatenateBuffers(chunkPairs, collisionPairs);
+}
+
+/*
+====================================================
+SweepAndPrune
+====================================================
+*/
+void SweepAndPrune::Clear() {
+  m_Pairs.clear();
+  m_SortedBodies.clear();
+}
+
+void SweepAndPrune::Update(const Body *bodies, const i32 num,
+                           const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Pairs.clear();
+
+  // Static bodies are paired by the StaticBroadPhase
+  m_DynamicIds.clear();
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i])) {
+      m_DynamicIds.push_back(i);
+    }
+  }
+  const i32 numDynamic = (i32)m_DynamicIds.size();
+  m_SortedBodies.resize(numDynamic * 2);
+  m_Scratch.resize(numDynamic * 2);
+  m_BodyBounds.resize(num);
+  m_Ranks.resize(num);
+
+  const Vec3 axis = ChooseSweepAxis(bodies, num);
+  SortBodiesBounds(bodies, m_DynamicIds.data(), numDynamic, axis,
+                   m_SortedBodies.data(), m_Scratch.data(), m_BodyBounds.data(),
+                   dt_sec);
+  BuildSweepBounds(m_SortedBodies.data(), m_BodyBounds.data(), numDynamic,
+                   m_Ranks, m_Sweep);
+  if (numDynamic >= kParallelSweepMinBodies && omp_get_max_threads() > 1) {
+    BuildPairsParallel(m_Pairs, m_Sweep, numDynamic, m_WorkPrefix,
+                       m_ChunkStarts, m_ChunkPairs);
+  } else {
+    BuildPairs(m_Pairs, m_Sweep, numDynamic);
+  }
+
+  HELIX_PROFILER_PLOT("Broadphase Axis X", axis.x);
+  HELIX_PROFILER_PLOT("Broadphase Axis Y", axis.y);
+  HELIX_PROFILER_PLOT("Broadphase Axis Z", axis.z);
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+}
+
+/*
+====================================================
+IncrementalSweepAndPrune
+====================================================
+*/
+void IncrementalSweepAndPrune::Clear() {
+  m_NumBodies = 0;
+  m_IsStatic.clear();
+  m_Endpoints.clear();
+  m_Pairs.clear();
+  m_PairIndices.Clear();
+  m_PairEvents.clear();
+  m_AddedPairs.clear();
+  m_RemovedPairs.clear();
+}
+
+void IncrementalSweepAndPrune::Update(const Body *bodies, const i32 num,
+                                      const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_AddedPairs.clear();
+  m_RemovedPairs.clear();
+  m_PairEvents.clear();
+
+  // Bodies were added, removed or made static, the endpoint array has to be
+  // rebuilt
+  bool rebuild = num != m_NumBodies;
+  for (i32 i = 0; i < num && !rebuild; i++) {
+    rebuild = m_IsStatic[i] != (u8)IsStaticBody(&bodies[i]);
+  }
+
+  if (rebuild || ++m_StepsSinceAxisUpdate >= kAxisUpdateInterval) {
+    m_StepsSinceAxisUpdate = 0;
+    const Vec3 axis = ChooseSweepAxis(bodies, num);
+    // The endpoint order is only valid for the axis it was sorted on
+    if (rebuild || fabsf(glm::dot(axis, m_Axis)) < 0.95f) {
+      m_Axis = axis;
+      rebuild = true;
+    }
+  }
+
+  m_Projections.resize(num * 2);
+  for (i32 i = 0; i < num; i++) {
+    const Bounds bounds = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    ProjectBounds(bounds, m_Axis, m_Projections[i * 2 + 0],
+                  m_Projections[i * 2 + 1]);
+  }
+
+  HELIX_PROFILER_PLOT("Broadphase Axis X", m_Axis.x);
+  HELIX_PROFILER_PLOT("Broadphase Axis Y", m_Axis.y);
+  HELIX_PROFILER_PLOT("Broadphase Axis Z", m_Axis.z);
+
+  if (rebuild) {
+    m_IsStatic.resize(num);
+    for (i32 i = 0; i < num; i++) {
+      m_IsStatic[i] = (u8)IsStaticBody(&bodies[i]);
+    }
+    Rebuild(num);
+    HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+    return;
+  }
+
+  // Write the new values in place, the endpoints keep last step's order
+  for (PsuedoBody &endpoint : m_Endpoints) {
+    endpoint.value = m_Projections[endpoint.id * 2 + (endpoint.ismin ? 0 : 1)];
+  }
+
+  InsertionSort();
+
+  // A pair can toggle several times in one sort. The first event tells us the
+  // state it had before the step, so compare that with where it ended up
+  m_VisitedEvents.Clear();
+  for (const std::pair<u64, bool> &event : m_PairEvents) {
+    if (m_VisitedEvents.Find(event.first) != -1) {
       continue;
     }
+    m_VisitedEvents.Set(event.first, 0);
+    const bool overlapping = m_PairIndices.Find(event.first) != -1;
+    if (event.second == overlapping) {
+      CollisionPair pair;
+      pair.a = (i32)(event.first >> 32);
+      pair.b = (i32)(event.first & 0xffffffff);
+      if (overlapping) {
+        m_AddedPairs.push_back(pair);
+      } else {
+        m_RemovedPairs.push_back(pair);
+      }
+    }
+  }
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+}
 
-    CollisionPair pair;
-    pair.a = a.id;
+void IncrementalSweepAndPrune::Rebuild(const i32 num) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  PairHashTable previousPairs;
+  std::swap(previousPairs, m_PairIndices);
+  m_Pairs.clear();
+
+  // Only dynamic bodies get endpoints, static ones are paired by the
+  // StaticBroadPhase
+  m_NumBodies = num;
+  i32 numDynamic = 0;
+  for (i32 i = 0; i < num; i++) {
+    numDynamic += m_IsStatic[i] ? 0 : 1;
+  }
+  const i32 numEndpoints = numDynamic * 2;
+  m_Endpoints.resize(numEndpoints);
+  m_Scratch.resize(numEndpoints);
+  i32 index = 0;
+  for (i32 i = 0; i < num; i++) {
+    if (m_IsStatic[i]) {
+      continue;
+    }
+    m_Endpoints[index].id = i;
+    m_Endpoints[index].value = m_Projections[i * 2 + 0];
+    m_Endpoints[index].ismin = true;
+
+    m_Endpoints[numDynamic + index].id = i;
+    m_Endpoints[numDynamic + index].value = m_Projections[i * 2 + 1];
+    m_Endpoints[numDynamic + index].ismin = false;
+    index++;
+  }
+  RadixSort(m_Endpoints.data(), m_Scratch.data(), numEndpoints,
+            [](const PsuedoBody &endpoint) {
+              return FloatToSortableKey(endpoint.value);
+            });
 
-    for (i32 j = i + 1; j < num * 2; j++) {
-      const PsuedoBody &b = sortedBodies[j];
-      // if we've hit the end of the a element, then we're done creating pairs
-      // with a
+  // The pair set has to match the endpoint order exactly for the swaps to keep
+  // it up to date, so only the sweep axis is tested here
+  for (i32 i = 0; i < numEndpoints; i++) {
+    const PsuedoBody &a = m_Endpoints[i];
+    if (!a.ismin) {
+      continue;
+    }
+    for (i32 j = i + 1; j < numEndpoints; j++) {
+      const PsuedoBody &b = m_Endpoints[j];
       if (b.id == a.id) {
         break;
       }
-
       if (!b.ismin) {
         continue;
       }
+      AddPair(a.id, b.id);
+      if (!previousPairs.Remove(GetPairKey(a.id, b.id))) {
+        m_AddedPairs.push_back(m_Pairs.back());
+      }
+    }
+  }
+
+  // Whatever is left did not survive the rebuild
+  previousPairs.ForEach([this](const u64 key, const i32) {
+    CollisionPair pair;
+    pair.a = (i32)(key >> 32);
+    pair.b = (i32)(key & 0xffffffff);
+    m_RemovedPairs.push_back(pair);
+  });
+}
+
+// Endpoint order used by the insertion sort. Matches the radix sorted order,
+// where a min goes before a max with the same value so touching intervals
+// overlap
+static inline bool SortsAfter(const PsuedoBody &lhs, const PsuedoBody &rhs) {
+  if (lhs.value != rhs.value) {
+    return lhs.value > rhs.value;
+  }
+  return !lhs.ismin && rhs.ismin;
+}
+
+void IncrementalSweepAndPrune::InsertionSort() {
+  const i32 numEndpoints = (i32)m_Endpoints.size();
+  for (i32 i = 1; i < numEndpoints; i++) {
+    const PsuedoBody endpoint = m_Endpoints[i];
+    i32 j = i - 1;
+    while (j >= 0 && SortsAfter(m_Endpoints[j], endpoint)) {
+      const PsuedoBody &other = m_Endpoints[j];
+      // A min moving below another body's max starts an overlap, a max moving
+      // below another body's min ends one. min/min and max/max swaps do not
+      // change anything
+      if (endpoint.ismin && !other.ismin) {
+        AddPair(endpoint.id, other.id);
+        m_PairEvents.push_back({GetPairKey(endpoint.id, other.id), true});
+      } else if (!endpoint.ismin && other.ismin) {
+        RemovePair(endpoint.id, other.id);
+        m_PairEvents.push_back({GetPairKey(endpoint.id, other.id), false});
+      }
+      m_Endpoints[j + 1] = other;
+      j--;
+    }
+    m_Endpoints[j + 1] = endpoint;
+  }
+}
+
+void IncrementalSweepAndPrune::AddPair(const i32 a, const i32 b) {
+  const u64 key = GetPairKey(a, b);
+  if (m_PairIndices.Find(key) != -1) {
+    return;
+  }
+  CollisionPair pair;
+  pair.a = a < b ? a : b;
+  pair.b = a < b ? b : a;
+  m_PairIndices.Set(key, (i32)m_Pairs.size());
+  m_Pairs.push_back(pair);
+}
+
+void IncrementalSweepAndPrune::RemovePair(const i32 a, const i32 b) {
+  const u64 key = GetPairKey(a, b);
+  const i32 index = m_PairIndices.Find(key);
+  if (index == -1) {
+    return;
+  }
+  // Swap with the last pair so the list stays packed
+  m_PairIndices.Remove(key);
+  if (index != (i32)m_Pairs.size() - 1) {
+    m_Pairs[index] = m_Pairs.back();
+    m_PairIndices.Set(GetPairKey(m_Pairs[index].a, m_Pairs[index].b), index);
+  }
+  m_Pairs.pop_back();
+}
+
+/*
+====================================================
+DynamicTreeBroadPhase
+====================================================
+*/
+void DynamicTreeBroadPhase::Clear() {
+  m_Tree.Clear();
+  m_Proxies.clear();
+  m_Bounds.clear();
+  m_Pairs.clear();
+}
+
+void DynamicTreeBroadPhase::Update(const Body *bodies, const i32 num,
+                                   const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  while ((i32)m_Proxies.size() > num) {
+    if (m_Proxies.back() != AABB_NULL_NODE) {
+      m_Tree.DestroyProxy(m_Proxies.back());
+    }
+    m_Proxies.pop_back();
+  }
+  m_Proxies.resize(num, AABB_NULL_NODE);
+
+  // Static bodies are paired by the StaticBroadPhase and get no proxy
+  m_Bounds.resize(num);
+  for (i32 i = 0; i < num; i++) {
+    i32 &proxy = m_Proxies[i];
+    if (IsStaticBody(&bodies[i])) {
+      if (proxy != AABB_NULL_NODE) {
+        m_Tree.DestroyProxy(proxy);
+        proxy = AABB_NULL_NODE;
+      }
+      continue;
+    }
+    m_Bounds[i] = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    if (proxy != AABB_NULL_NODE) {
+      m_Tree.MoveProxy(proxy, m_Bounds[i], kFatMargin);
+    } else {
+      proxy = m_Tree.CreateProxy(m_Bounds[i], i, kFatMargin);
+    }
+  }
+
+  // The fat boxes only give candidates, keep the pairs whose swept bounds
+  // actually overlap
+  m_Pairs.clear();
+  m_Tree.QueryPairs([this](const i32 a, const i32 b) {
+    if (m_Bounds[a].DoesIntersect(m_Bounds[b])) {
+      CollisionPair pair;
+      pair.a = a;
+      pair.b = b;
+      m_Pairs.push_back(pair);
+    }
+  });
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+}
+
+/*
+====================================================
+SpatialHashGrid
+====================================================
+*/
+static inline f32 GetMaxExtent(const Bounds &bounds) {
+  return glm::max(bounds.WidthX(), glm::max(bounds.WidthY(), bounds.WidthZ()));
+}
+
+static inline i32 GetCellCoord(const f32 value, const f32 invCellSize) {
+  return (i32)floorf(value * invCellSize);
+}
+
+u32 SpatialHashGrid::HashCell(const i32 x, const i32 y, const i32 z) const {
+  const u32 hash =
+      ((u32)x * 73856093u) ^ ((u32)y * 19349663u) ^ ((u32)z * 83492791u);
+  return hash & m_TableMask;
+}
+
+void SpatialHashGrid::Clear() {
+  m_Bounds.clear();
+  m_Extents.clear();
+  m_CellStart.clear();
+  m_CellCount.clear();
+  m_CellBodies.clear();
+  m_BodyCells.clear();
+  m_BodyCoords.clear();
+  m_LargeBodies.clear();
+  m_Pairs.clear();
+}
+
+void SpatialHashGrid::Update(const Body *bodies, const i32 num,
+                             const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Pairs.clear();
+  m_LargeBodies.clear();
+  if (num == 0) {
+    return;
+  }
+
+  m_Bounds.resize(num);
+  m_Extents.resize(num);
+  m_MedianScratch.clear();
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      continue;
+    }
+    m_Bounds[i] = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    m_Extents[i] = GetMaxExtent(m_Bounds[i]);
+    m_MedianScratch.push_back(m_Extents[i]);
+  }
+  if (m_MedianScratch.empty()) {
+    return;
+  }
+
+  // Size the cells from the median body, ignoring anything more than twice as
+  // large so a few huge bodies do not blow up the cells for everyone else
+  const size_t median = m_MedianScratch.size() / 2;
+  std::nth_element(m_MedianScratch.begin(), m_MedianScratch.begin() + median,
+                   m_MedianScratch.end());
+  const f32 largeExtent = m_MedianScratch[median] * 2.f;
+  m_CellSize = 0.f;
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i]) && m_Extents[i] <= largeExtent) {
+      m_CellSize = glm::max(m_CellSize, m_Extents[i]);
+    }
+  }
+  m_CellSize = glm::max(m_CellSize, 1e-3f);
+  const f32 invCellSize = 1.f / m_CellSize;
+
+  u32 tableSize = 1;
+  while (tableSize < (u32)num * 2) {
+    tableSize <<= 1;
+  }
+  m_TableMask = tableSize - 1;
+  m_CellStart.resize(tableSize);
+  m_CellCount.assign(tableSize, 0);
+  m_BodyCells.resize(num);
+  m_BodyCoords.resize(num);
+
+  // Counting sort of the bodies into their cells
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      m_BodyCells[i] = u32_max;
+      continue;
+    }
+    if (m_Extents[i] > largeExtent) {
+      m_LargeBodies.push_back(i);
+      m_BodyCells[i] = u32_max;
+      continue;
+    }
+    const Vec3 center = (m_Bounds[i].mins + m_Bounds[i].maxs) * 0.5f;
+    glm::ivec3 &coord = m_BodyCoords[i];
+    coord.x = GetCellCoord(center.x, invCellSize);
+    coord.y = GetCellCoord(center.y, invCellSize);
+    coord.z = GetCellCoord(center.z, invCellSize);
+    m_BodyCells[i] = HashCell(coord.x, coord.y, coord.z);
+    m_CellCount[m_BodyCells[i]]++;
+  }
+
+  u32 offset = 0;
+  for (u32 cell = 0; cell < tableSize; cell++) {
+    m_CellStart[cell] = offset;
+    offset += m_CellCount[cell];
+  }
+
+  m_CellBodies.resize(offset);
+  for (i32 i = 0; i < num; i++) {
+    if (m_BodyCells[i] == u32_max) {
+      continue;
+    }
+    m_CellBodies[m_CellStart[m_BodyCells[i]]++] = i;
+  }
+  // The scatter advanced every start to the end of its cell
+  for (u32 cell = 0; cell < tableSize; cell++) {
+    m_CellStart[cell] -= m_CellCount[cell];
+  }
+
+  // Walk the bodies in cell order so neighbouring bodies are visited together
+  for (const i32 a : m_CellBodies) {
+    const Bounds &boundsA = m_Bounds[a];
+    const glm::ivec3 coordA = m_BodyCoords[a];
+    for (i32 z = coordA.z - 1; z <= coordA.z + 1; z++) {
+      for (i32 y = coordA.y - 1; y <= coordA.y + 1; y++) {
+        for (i32 x = coordA.x - 1; x <= coordA.x + 1; x++) {
+          const u32 cell = HashCell(x, y, z);
+          const u32 start = m_CellStart[cell];
+          const u32 end = start + m_CellCount[cell];
+          for (u32 k = start; k < end; k++) {
+            const i32 b = m_CellBodies[k];
+            // Each pair is reported from its lower id. Other cells can hash
+            // to the same bucket, so only accept bodies from this exact cell
+            if (b <= a || m_BodyCoords[b] != glm::ivec3(x, y, z) ||
+                !boundsA.DoesIntersect(m_Bounds[b])) {
+              continue;
+            }
+            CollisionPair pair;
+            pair.a = a;
+            pair.b = b;
+            m_Pairs.push_back(pair);
+          }
+        }
+      }
+    }
+  }
+
+  // Large bodies are tested against everything
+  for (const i32 a : m_LargeBodies) {
+    for (i32 b = 0; b < num; b++) {
+      if (b == a || IsStaticBody(&bodies[b]) ||
+          (m_BodyCells[b] == u32_max && b < a)) {
+        continue;
+      }
+      if (m_Bounds[a].DoesIntersect(m_Bounds[b])) {
+        CollisionPair pair;
+        pair.a = a;
+        pair.b = b;
+        m_Pairs.push_back(pair);
+      }
+    }
+  }
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+}
+
+/*
+====================================================
+HierarchicalGrid
+====================================================
+*/
+u32 HierarchicalGrid::HashCell(const glm::ivec3 &coord, const i32 level) const {
+  const u32 hash = ((u32)coord.x * 73856093u) ^ ((u32)coord.y * 19349663u) ^
+                   ((u32)coord.z * 83492791u) ^ ((u32)level * 2654435761u);
+  return hash & m_TableMask;
+}
 
-      pair.b = b.id;
-      collisionPairs.push_back(pair);
+static inline glm::ivec3 GetCellCoords(const Vec3 &point,
+                                       const f32 invCellSize) {
+  return glm::ivec3(GetCellCoord(point.x, invCellSize),
+                    GetCellCoord(point.y, invCellSize),
+                    GetCellCoord(point.z, invCellSize));
+}
+
+void HierarchicalGrid::Clear() {
+  m_OccupiedLevels = 0;
+  m_Bounds.clear();
+  m_CellStart.clear();
+  m_CellCount.clear();
+  m_CellBodies.clear();
+  m_BodyCells.clear();
+  m_BodyCoords.clear();
+  m_BodyLevels.clear();
+  m_Pairs.clear();
+}
+
+void HierarchicalGrid::Update(const Body *bodies, const i32 num,
+                              const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Pairs.clear();
+  m_OccupiedLevels = 0;
+  for (f32 &extent : m_LevelExtents) {
+    extent = 0.f;
+  }
+
+  m_Bounds.resize(num);
+  f32 minExtent = std::numeric_limits<f32>::max();
+  f32 maxExtent = 0.f;
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      continue;
     }
+    m_Bounds[i] = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    const f32 extent = GetMaxExtent(m_Bounds[i]);
+    minExtent = glm::min(minExtent, extent);
+    maxExtent = glm::max(maxExtent, extent);
   }
+  if (maxExtent == 0.f) {
+    return;
+  }
+
+  // The finest level fits the smallest body. Only if the size range is too
+  // wide for the levels available does the base grow so the largest body
+  // still fits the coarsest level
+  m_BaseCellSize = glm::max(minExtent, 1e-3f);
+  m_BaseCellSize = glm::max(m_BaseCellSize,
+                            ldexpf(maxExtent, -(kMaxLevels - 1)));
+
+  u32 tableSize = 1;
+  while (tableSize < (u32)num * 2) {
+    tableSize <<= 1;
+  }
+  m_TableMask = tableSize - 1;
+  m_CellStart.resize(tableSize);
+  m_CellCount.assign(tableSize, 0);
+  m_BodyCells.resize(num);
+  m_BodyCoords.resize(num);
+  m_BodyLevels.resize(num);
+
+  // Counting sort of the bodies into the cells of their level
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      m_BodyCells[i] = u32_max;
+      continue;
+    }
+    const f32 extent = GetMaxExtent(m_Bounds[i]);
+    i32 level = 0;
+    f32 cellSize = m_BaseCellSize;
+    while (cellSize < extent && level < kMaxLevels - 1) {
+      cellSize *= 2.f;
+      level++;
+    }
+    const Vec3 center = (m_Bounds[i].mins + m_Bounds[i].maxs) * 0.5f;
+    m_BodyLevels[i] = level;
+    m_BodyCoords[i] = GetCellCoords(center, 1.f / cellSize);
+    m_BodyCells[i] = HashCell(m_BodyCoords[i], level);
+    m_CellCount[m_BodyCells[i]]++;
+    m_OccupiedLevels |= 1u << level;
+    m_LevelExtents[level] = glm::max(m_LevelExtents[level], extent);
+  }
+
+  u32 offset = 0;
+  for (u32 cell = 0; cell < tableSize; cell++) {
+    m_CellStart[cell] = offset;
+    offset += m_CellCount[cell];
+  }
+
+  m_CellBodies.resize(offset);
+  for (i32 i = 0; i < num; i++) {
+    if (m_BodyCells[i] == u32_max) {
+      continue;
+    }
+    m_CellBodies[m_CellStart[m_BodyCells[i]]++] = i;
+  }
+  for (u32 cell = 0; cell < tableSize; cell++) {
+    m_CellStart[cell] -= m_CellCount[cell];
+  }
+
+  for (const i32 a : m_CellBodies) {
+    const Bounds &boundsA = m_Bounds[a];
+    const i32 levelA = m_BodyLevels[a];
+
+    // Walk this level and every coarser level that holds a body. Pairs within
+    // a level are reported from the lower id, pairs across levels from the
+    // body on the finer level
+    u32 levels = m_OccupiedLevels >> levelA;
+    f32 cellSize = ldexpf(m_BaseCellSize, levelA);
+    for (i32 level = levelA; levels != 0;
+         level++, levels >>= 1, cellSize *= 2.f) {
+      if ((levels & 1) == 0) {
+        continue;
+      }
+      // A body on this level that overlaps A has its center within half the
+      // level's largest extent of A's bounds, which spans at most two or
+      // three cells per axis
+      const f32 invCellSize = 1.f / cellSize;
+      const Vec3 reach(m_LevelExtents[level] * 0.5f);
+      const glm::ivec3 lo = GetCellCoords(boundsA.mins - reach, invCellSize);
+      const glm::ivec3 hi = GetCellCoords(boundsA.maxs + reach, invCellSize);
+      for (i32 z = lo.z; z <= hi.z; z++) {
+        for (i32 y = lo.y; y <= hi.y; y++) {
+          for (i32 x = lo.x; x <= hi.x; x++) {
+            const glm::ivec3 coord(x, y, z);
+            const u32 cell = HashCell(coord, level);
+            const u32 start = m_CellStart[cell];
+            const u32 end = start + m_CellCount[cell];
+            for (u32 k = start; k < end; k++) {
+              const i32 b = m_CellBodies[k];
+              // Other cells and levels can hash to the same bucket
+              if (m_BodyLevels[b] != level || m_BodyCoords[b] != coord ||
+                  (level == levelA && b <= a) ||
+                  !boundsA.DoesIntersect(m_Bounds[b])) {
+                continue;
+              }
+              CollisionPair pair;
+              pair.a = a;
+              pair.b = b;
+              m_Pairs.push_back(pair);
+            }
+          }
+        }
+      }
+    }
+  }
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
 }
 
-void SweepAndPrune1D(const Body *bodies, const i32 num,
-                     std::vector<CollisionPair> &finalPairs, const f32 dt_sec) {
-  PsuedoBody *sortedBodies = (PsuedoBody *)alloca(sizeof(PsuedoBody) * num * 2);
+/*
+====================================================
+StaticBroadPhase
+====================================================
+*/
+void StaticBroadPhase::Clear() {
+  m_Tree.Clear();
+  m_Dirty = true;
+  m_StaticIds.clear();
+  m_Pairs.clear();
+}
 
-  SortBodiesBounds(bodies, num, sortedBodies, dt_sec);
-  BuildPairs(finalPairs, sortedBodies, num);
+void StaticBroadPhase::Rebuild(const Body *bodies, const i32 num) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Tree.Clear();
+  m_StaticIds.clear();
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i])) {
+      continue;
+    }
+    const Bounds bounds = GetBroadPhaseBounds(&bodies[i], 0.f);
+    m_StaticIds.push_back(i);
+    // Static bounds never move, so the leaves do not need a fat margin
+    m_Tree.CreateProxy(bounds, i, 0.f);
+  }
+  m_Dirty = false;
+  m_RebuildCount++;
 }
 
-void BroadPhase(const Body *bodies, const i32 num,
-                std::vector<CollisionPair> &finalPairs, const f32 dt_sec) {
+void StaticBroadPhase::Sync(const Body *bodies, const i32 num) {
+  if (m_Dirty) {
+    Rebuild(bodies, num);
+  }
+}
+
+void StaticBroadPhase::Update(const Body *bodies, const i32 num,
+                              const f32 dt_sec) {
   HELIX_PROFILER_FUNCTION_COLOR();
-  finalPairs.clear();
+  Sync(bodies, num);
+
+  m_Pairs.clear();
+  if (m_StaticIds.empty()) {
+    return;
+  }
+  for (i32 i = 0; i < num; i++) {
+    if (IsStaticBody(&bodies[i])) {
+      continue;
+    }
+    const Bounds bounds = GetBroadPhaseBounds(&bodies[i], dt_sec);
+    m_Tree.Query(bounds, [this, i](const i32 staticId) {
+      CollisionPair pair;
+      pair.a = i < staticId ? i : staticId;
+      pair.b = i < staticId ? staticId : i;
+      m_Pairs.push_back(pair);
+      return true;
+    });
+  }
+  HELIX_PROFILER_PLOT("Broadphase Static Pairs", (i64)m_Pairs.size());
+}
+
+/*
+====================================================
+PairCache
+====================================================
+*/
+void PairCache::Clear() {
+  m_Table.Clear();
+  m_Pairs.clear();
+  m_AddedPairs.clear();
+  m_RemovedPairs.clear();
+}
+
+void PairCache::BeginStep() {
+  m_Step++;
+  m_AddedPairs.clear();
+  m_RemovedPairs.clear();
+}
+
+void PairCache::AddPairs(const std::vector<CollisionPair> &pairs) {
+  for (const CollisionPair &pair : pairs) {
+    const u64 key = GetPairKey(pair.a, pair.b);
+    const i32 index = m_Table.Find(key);
+    if (index != -1) {
+      m_Pairs[index].lastStep = m_Step;
+      continue;
+    }
+
+    CachedPair cached;
+    cached.pair.a = pair.a < pair.b ? pair.a : pair.b;
+    cached.pair.b = pair.a < pair.b ? pair.b : pair.a;
+    cached.lastStep = m_Step;
+    cached.separation = 0.f;
+    m_Table.Set(key, (i32)m_Pairs.size());
+    m_Pairs.push_back(cached);
+    m_AddedPairs.push_back(cached.pair);
+  }
+}
+
+void PairCache::EndStep() {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  // Pairs the broadphase stopped reporting are swapped out of the packed
+  // array, moving the last pair into their slot
+  for (i32 i = 0; i < (i32)m_Pairs.size();) {
+    if (m_Pairs[i].lastStep == m_Step) {
+      i++;
+      continue;
+    }
+    m_RemovedPairs.push_back(m_Pairs[i].pair);
+    m_Table.Remove(GetPairKey(m_Pairs[i].pair.a, m_Pairs[i].pair.b));
+    if (i != (i32)m_Pairs.size() - 1) {
+      m_Pairs[i] = m_Pairs.back();
+      m_Table.Set(GetPairKey(m_Pairs[i].pair.a, m_Pairs[i].pair.b), i);
+    }
+    m_Pairs.pop_back();
+  }
+  HELIX_PROFILER_PLOT("Broadphase Added Pairs", (i64)m_AddedPairs.size());
+  HELIX_PROFILER_PLOT("Broadphase Removed Pairs", (i64)m_RemovedPairs.size());
+}
+
+/*
+====================================================
+SphereContactSweep
+====================================================
+*/
+// Swept sphere test of two bodies, appends a contact with the lower id as
+// bodyA on a hit
+static inline void TestSpheres(Body *bodies, const i32 idA, const i32 idB,
+                               const f32 dt_sec,
+                               std::vector<Contact> &contacts) {
+  Body *bodyA = &bodies[idA < idB ? idA : idB];
+  Body *bodyB = &bodies[idA < idB ? idB : idA];
+  Contact contact;
+  if (SphereSphereDynamic(bodyA->transform.GetScale().x,
+                          bodyB->transform.GetScale().x,
+                          bodyA->transform.GetPosition(),
+                          bodyB->transform.GetPosition(),
+                          bodyA->linearVelocity, bodyB->linearVelocity, dt_sec,
+                          contact.ptOnA_WorldSpace, contact.ptOnB_WorldSpace,
+                          contact.timeOfImpact)) {
+    contact.bodyA = bodyA;
+    contact.bodyB = bodyB;
+    FinishContact(contact);
+    contacts.push_back(contact);
+  }
+}
+
+void SphereContactSweep::Clear() {
+  m_StaticBroadPhase.Clear();
+  m_SortedBodies.clear();
+  m_ChunkContacts.clear();
+  m_TestedPairs = 0;
+  m_TestedStaticPairs = 0;
+}
+
+void SphereContactSweep::SweepChunk(Body *bodies, const i32 firstRank,
+                                    const i32 endRank, const f32 dt_sec,
+                                    std::vector<Contact> &contacts,
+                                    u32 &testedPairs) const {
+  for (i32 rank = firstRank; rank < endRank; rank++) {
+    const i32 id = m_Sweep.ids[rank];
+    SweepRank(m_Sweep, rank, rank + 1, m_Sweep.endRanks[rank],
+              [&](const i32 otherId) {
+                testedPairs++;
+                TestSpheres(bodies, id, otherId, dt_sec, contacts);
+              });
+  }
+}
+
+void SphereContactSweep::FindContacts(Body *bodies, const i32 num,
+                                      const f32 dt_sec,
+                                      ContactPool &contacts) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_TestedPairs = 0;
+  m_TestedStaticPairs = 0;
+
+  m_DynamicIds.clear();
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i])) {
+      m_DynamicIds.push_back(i);
+    }
+  }
+  const i32 numDynamic = (i32)m_DynamicIds.size();
+  m_SortedBodies.resize(numDynamic * 2);
+  m_Scratch.resize(numDynamic * 2);
+  m_BodyBounds.resize(num);
+  m_Ranks.resize(num);
+
+  const Vec3 axis = ChooseSweepAxis(bodies, num);
+  SortBodiesBounds(bodies, m_DynamicIds.data(), numDynamic, axis,
+                   m_SortedBodies.data(), m_Scratch.data(), m_BodyBounds.data(),
+                   dt_sec);
+  BuildSweepBounds(m_SortedBodies.data(), m_BodyBounds.data(), numDynamic,
+                   m_Ranks, m_Sweep);
+
+  // Contacts go into one buffer per chunk of ranks plus one for the static
+  // contacts, which are merged into the pool in that order
+  const bool parallel =
+      numDynamic >= kParallelSweepMinBodies && omp_get_max_threads() > 1;
+  const i32 numChunks = parallel ? omp_get_max_threads() * 4 : 1;
+  m_ChunkContacts.resize(numChunks + 1);
+  for (std::vector<Contact> &chunkContacts : m_ChunkContacts) {
+    chunkContacts.clear();
+  }
+  if (parallel) {
+    SplitSweepRanks(m_Sweep, numDynamic, numChunks, m_WorkPrefix,
+                    m_ChunkStarts);
+    m_ChunkTestedPairs.resize(numChunks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i32 chunk = 0; chunk < numChunks; chunk++) {
+      m_ChunkTestedPairs[chunk] = 0;
+      SweepChunk(bodies, m_ChunkStarts[chunk], m_ChunkStarts[chunk + 1],
+                 dt_sec, m_ChunkContacts[chunk], m_ChunkTestedPairs[chunk]);
+    }
+    for (i32 chunk = 0; chunk < numChunks; chunk++) {
+      m_TestedPairs += m_ChunkTestedPairs[chunk];
+    }
+  } else {
+    SweepChunk(bodies, 0, numDynamic, dt_sec, m_ChunkContacts[0],
+               m_TestedPairs);
+  }
+
+  // The swept bounds of the dynamic bodies are still around from the sort
+  m_StaticBroadPhase.Sync(bodies, num);
+  const DynamicAABBTree &staticTree = m_StaticBroadPhase.GetTree();
+  std::vector<Contact> &staticContacts = m_ChunkContacts[numChunks];
+  for (i32 i = 0; i < numDynamic; i++) {
+    const i32 id = m_DynamicIds[i];
+    staticTree.Query(m_BodyBounds[id], [&](const i32 staticId) {
+      m_TestedStaticPairs++;
+      TestSpheres(bodies, id, staticId, dt_sec, staticContacts);
+      return true;
+    });
+  }
+
+  size_t numContacts = 0;
+  for (const std::vector<Contact> &chunkContacts : m_ChunkContacts) {
+    numContacts += chunkContacts.size();
+  }
+  ConcatenateBuffers(m_ChunkContacts, contacts.Allocate((i32)numContacts));
 
-  SweepAndPrune1D(bodies, num, finalPairs, dt_sec);
+  HELIX_PROFILER_PLOT("Broadphase Axis X", axis.x);
+  HELIX_PROFILER_PLOT("Broadphase Axis Y", axis.y);
+  HELIX_PROFILER_PLOT("Broadphase Axis Z", axis.z);
 }
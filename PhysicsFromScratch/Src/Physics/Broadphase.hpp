@@ -1,5 +1,8 @@
 #pragma once
 #include "Body.hpp"
+#include "Contact.hpp"
+#include "DynamicAABBTree.hpp"
+#include "PairHashTable.hpp"
 #include <vector>
 
 struct CollisionPair {
@@ -12,5 +15,408 @@ struct CollisionPair {
   bool operator!=(const CollisionPair &rhs) const { return !(*this == rhs); }
 };
 
-void BroadPhase(const Body *bodies, const i32 num,
-                std::vector<CollisionPair> &finalPairs, const f32 dt_sec);
+struct PsuedoBody {
+  i32 id;
+  f32 value;
+  bool ismin;
+};
+
+// Swept bounds laid out as a structure of arrays, ordered by the rank of each
+// body's min endpoint along the sweep axis. The bodies a sweep has to test for a
+// given rank are the contiguous ranks up to endRanks[rank], so they can be
+// loaded several lanes at a time
+struct SweepBounds {
+  std::vector<i32> ids;      // Body id at each rank
+  std::vector<i32> endRanks; // First rank that starts after this body's max
+  std::vector<f32> minX;
+  std::vector<f32> minY;
+  std::vector<f32> minZ;
+  std::vector<f32> maxX;
+  std::vector<f32> maxY;
+  std::vector<f32> maxZ;
+
+  void Resize(const i32 num);
+};
+
+enum class BroadPhaseMode : u8 {
+  SweepAndPrune,
+  IncrementalSweepAndPrune,
+  DynamicTree,
+  SpatialHashGrid,
+  HierarchicalGrid,
+  LinearBVH,
+  Auto, // Picks one of the above from the scene, see AdaptiveBroadPhase
+  Count
+};
+
+const char *BroadPhaseModeName(const BroadPhaseMode mode);
+
+// Bodies with infinite mass never move. They live in the StaticBroadPhase and
+// are skipped by the per-frame broadphases
+inline bool IsStaticBody(const Body *body) { return body->invMass == 0.f; }
+
+// Bounds of a body swept by its linear velocity over dt_sec
+Bounds GetBroadPhaseBounds(const Body *body, const f32 dt_sec);
+
+// Principal axis of the dynamic body centers. Sweeping along the direction the
+// bodies are most spread out on keeps the projected intervals from piling up
+Vec3 ChooseSweepAxis(const Body *bodies, const i32 num);
+
+/*
+====================================================
+BroadPhaseInterface
+
+Common interface of the per-frame broadphases, which keep their state between
+calls to Update. They only pair dynamic bodies with each other, static bodies
+are paired by the StaticBroadPhase.
+====================================================
+*/
+class BroadPhaseInterface {
+public:
+  virtual ~BroadPhaseInterface() = default;
+
+  virtual void Update(const Body *bodies, const i32 num, const f32 dt_sec) = 0;
+  // Drops everything kept from earlier steps
+  virtual void Clear() = 0;
+
+  virtual const std::vector<CollisionPair> &GetPairs() const = 0;
+  // Interval endpoints sorted by the last Update, 0 for algorithms that do not
+  // sweep
+  virtual u32 GetSortedEndpoints() const { return 0; }
+};
+
+/*
+====================================================
+SweepAndPrune
+
+Sweep and prune along the principal axis. The endpoints are sorted from scratch
+every step, only the buffers are kept so they reallocate when the body count
+grows and not on every Update.
+====================================================
+*/
+class SweepAndPrune : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  u32 GetSortedEndpoints() const override {
+    return (u32)m_SortedBodies.size();
+  }
+
+private:
+  std::vector<CollisionPair> m_Pairs;
+  std::vector<i32> m_DynamicIds;
+  std::vector<PsuedoBody> m_SortedBodies;
+  std::vector<PsuedoBody> m_Scratch;
+  std::vector<Bounds> m_BodyBounds;
+  std::vector<i32> m_Ranks;
+  SweepBounds m_Sweep;
+  std::vector<u64> m_WorkPrefix;
+  std::vector<i32> m_ChunkStarts;
+  std::vector<std::vector<CollisionPair>> m_ChunkPairs;
+};
+
+/*
+====================================================
+IncrementalSweepAndPrune
+
+Sweep and prune that keeps its sorted endpoint array between steps. Each
+Update writes the new projections into the existing endpoints and re-sorts them
+with an insertion sort, which is close to O(n) when bodies move coherently.
+Pairs are added and removed as min/max endpoints swap past each other, so the
+pair list is maintained incrementally and the per-step deltas are available.
+====================================================
+*/
+class IncrementalSweepAndPrune : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  // All pairs whose intervals currently overlap
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  u32 GetSortedEndpoints() const override { return (u32)m_Endpoints.size(); }
+  // Pairs that started or stopped overlapping during the last Update
+  const std::vector<CollisionPair> &GetAddedPairs() const {
+    return m_AddedPairs;
+  }
+  const std::vector<CollisionPair> &GetRemovedPairs() const {
+    return m_RemovedPairs;
+  }
+
+private:
+  void Rebuild(const i32 num);
+  void InsertionSort();
+  void AddPair(const i32 a, const i32 b);
+  void RemovePair(const i32 a, const i32 b);
+
+private:
+  // Steps between re-evaluating the sweep axis. Changing the axis forces a
+  // full rebuild, so it is only swapped when the new one is clearly better
+  static constexpr u32 kAxisUpdateInterval = 60;
+
+  i32 m_NumBodies{0};
+  u32 m_StepsSinceAxisUpdate{0};
+  std::vector<u8> m_IsStatic; // Static flag per body when last rebuilt
+  Vec3 m_Axis{0.f};
+  std::vector<PsuedoBody> m_Endpoints;
+  std::vector<PsuedoBody> m_Scratch;
+  std::vector<f32> m_Projections; // Min and max projection per body
+
+  std::vector<CollisionPair> m_Pairs;
+  PairHashTable m_PairIndices; // Pair key to index in m_Pairs
+  // Pair toggles recorded while sorting, resolved into the deltas afterwards
+  std::vector<std::pair<u64, bool>> m_PairEvents;
+  PairHashTable m_VisitedEvents;
+  std::vector<CollisionPair> m_AddedPairs;
+  std::vector<CollisionPair> m_RemovedPairs;
+};
+
+/*
+====================================================
+DynamicTreeBroadPhase
+
+Keeps one DynamicAABBTree leaf per dynamic body. Leaves are enlarged by a
+margin on top of the velocity sweep and only re-inserted when the body leaves
+its fat box. Pairs come from traversing the tree against itself and are then
+filtered with the tight swept bounds. The tree can be used for ray and overlap
+queries.
+====================================================
+*/
+class DynamicTreeBroadPhase : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  const DynamicAABBTree &GetTree() const { return m_Tree; }
+
+private:
+  static constexpr f32 kFatMargin = 0.1f;
+
+  DynamicAABBTree m_Tree;
+  std::vector<i32> m_Proxies; // Proxy id per body
+  std::vector<Bounds> m_Bounds;
+  std::vector<CollisionPair> m_Pairs;
+};
+
+/*
+====================================================
+StaticBroadPhase
+
+Static bodies in their own DynamicAABBTree. The tree is only rebuilt after
+MarkDirty, which whoever adds, moves or removes a static body has to call, so
+a step with no edits does not look at the static bodies at all. Each Update
+queries the swept bounds of every dynamic body against it, so static-static pairs are
+never generated. The per-frame broadphases skip static bodies and only report
+dynamic-dynamic pairs.
+====================================================
+*/
+class StaticBroadPhase {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec);
+  // Only brings the tree up to date, for callers that query it themselves
+  void Sync(const Body *bodies, const i32 num);
+  void Clear();
+  // Rebuilds the tree on the next Sync. Also needed when a body turns static
+  // or stops being static
+  void MarkDirty() { m_Dirty = true; }
+
+  // Dynamic-static pairs
+  const std::vector<CollisionPair> &GetPairs() const { return m_Pairs; }
+  const DynamicAABBTree &GetTree() const { return m_Tree; }
+  u32 GetRebuildCount() const { return m_RebuildCount; }
+
+private:
+  void Rebuild(const Body *bodies, const i32 num);
+
+private:
+  DynamicAABBTree m_Tree;
+  bool m_Dirty{true};
+  u32 m_RebuildCount{0};
+  std::vector<i32> m_StaticIds; // Static bodies the tree was built from
+  std::vector<CollisionPair> m_Pairs;
+};
+
+/*
+====================================================
+SpatialHashGrid
+
+Uniform grid for scenes of similarly sized bodies. Every body is bucketed by
+the cell of its bounds center, with cells hashed into a table that is laid out
+by a counting sort (cell start/count arrays over one packed body array). Cells
+are sized to the largest regular body, so overlapping bodies always sit in
+adjacent cells. Dynamic bodies much larger than the median are kept out of the
+grid and tested against everything. Static bodies are left to the
+StaticBroadPhase.
+====================================================
+*/
+class SpatialHashGrid : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  f32 GetCellSize() const { return m_CellSize; }
+
+private:
+  u32 HashCell(const i32 x, const i32 y, const i32 z) const;
+
+private:
+  f32 m_CellSize{1.f};
+  u32 m_TableMask{0};
+  std::vector<Bounds> m_Bounds;
+  std::vector<f32> m_Extents;
+  std::vector<f32> m_MedianScratch;
+  std::vector<u32> m_CellStart;
+  std::vector<u32> m_CellCount;
+  std::vector<i32> m_CellBodies; // Body ids packed by cell
+  std::vector<u32> m_BodyCells;  // Hashed cell per body
+  std::vector<glm::ivec3> m_BodyCoords;
+  std::vector<i32> m_LargeBodies;
+  std::vector<CollisionPair> m_Pairs;
+};
+
+/*
+====================================================
+HierarchicalGrid
+
+Stack of hashed uniform grids whose cell size doubles at every level. Each body
+is inserted once, at the finest level whose cells are at least as large as its
+bounds, so tiny and huge bodies each get cells that fit them. A body then only
+checks its own level and the coarser levels that hold bodies, and only the
+cells there that can hold the center of a body overlapping it. All levels share one
+hash table laid out by a counting sort like the SpatialHashGrid.
+====================================================
+*/
+class HierarchicalGrid : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  f32 GetBaseCellSize() const { return m_BaseCellSize; }
+  u32 GetOccupiedLevels() const { return m_OccupiedLevels; }
+
+private:
+  u32 HashCell(const glm::ivec3 &coord, const i32 level) const;
+
+private:
+  static constexpr i32 kMaxLevels = 32;
+
+  f32 m_BaseCellSize{1.f};
+  u32 m_OccupiedLevels{0}; // Bit per level that holds at least one body
+  f32 m_LevelExtents[kMaxLevels]{}; // Largest body extent on each level
+  u32 m_TableMask{0};
+  std::vector<Bounds> m_Bounds;
+  std::vector<u32> m_CellStart;
+  std::vector<u32> m_CellCount;
+  std::vector<i32> m_CellBodies; // Body ids packed by cell
+  std::vector<u32> m_BodyCells;  // Hashed cell per body
+  std::vector<glm::ivec3> m_BodyCoords;
+  std::vector<i32> m_BodyLevels;
+  std::vector<CollisionPair> m_Pairs;
+};
+
+struct CachedPair {
+  CollisionPair pair; // a < b
+  u32 lastStep;       // Last step the broadphase reported the pair
+  // Lower bound on the gap between the bodies, kept up to date by the
+  // narrowphase. Zero or less means the pair has to be tested
+  f32 separation;
+};
+
+/*
+====================================================
+PairCache
+
+Overlapping pairs kept across steps. Pairs are found through an open
+addressing table keyed by the packed (minId, maxId) pair key and stored in one
+packed array, so each CachedPair can carry narrowphase state from step to step.
+Every step the broadphase output is fed through AddPairs between BeginStep and
+EndStep, which reports the pairs that appeared and the ones that went away.
+====================================================
+*/
+class PairCache {
+public:
+  void BeginStep();
+  void AddPairs(const std::vector<CollisionPair> &pairs);
+  void EndStep();
+  void Clear();
+
+  std::vector<CachedPair> &GetPairs() { return m_Pairs; }
+  const std::vector<CollisionPair> &GetAddedPairs() const {
+    return m_AddedPairs;
+  }
+  const std::vector<CollisionPair> &GetRemovedPairs() const {
+    return m_RemovedPairs;
+  }
+
+private:
+  PairHashTable m_Table; // Pair key to index in m_Pairs
+  std::vector<CachedPair> m_Pairs;
+  std::vector<CollisionPair> m_AddedPairs;
+  std::vector<CollisionPair> m_RemovedPairs;
+  u32 m_Step{0};
+};
+
+/*
+====================================================
+SphereContactSweep
+
+Fused broadphase and narrowphase for worlds made only of spheres. The dynamic
+bodies are swept along the principal axis like the SweepAndPrune, but every
+candidate that survives the bounds test goes straight into the swept sphere
+test and only hits are written out, as Contacts. Dynamic-static candidates come
+from querying a StaticBroadPhase tree the same way. No pair list is built or
+read back, and there is no pair cache, so nothing is carried between steps.
+Large sweeps run in parallel chunks merged in rank order, so the contacts come
+out in the same order on any number of threads.
+====================================================
+*/
+class SphereContactSweep {
+public:
+  // Adds a contact to the pool for every pair that touches within dt_sec,
+  // with bodyA the lower id
+  void FindContacts(Body *bodies, const i32 num, const f32 dt_sec,
+                    ContactPool &contacts);
+  void Clear();
+  // See StaticBroadPhase::MarkDirty
+  void MarkStaticDirty() { m_StaticBroadPhase.MarkDirty(); }
+
+  // Pairs that passed the bounds test and went through the sphere test
+  u32 GetTestedPairs() const { return m_TestedPairs; }
+  u32 GetTestedStaticPairs() const { return m_TestedStaticPairs; }
+  u32 GetSortedEndpoints() const { return (u32)m_SortedBodies.size(); }
+
+private:
+  void SweepChunk(Body *bodies, const i32 firstRank, const i32 endRank,
+                  const f32 dt_sec, std::vector<Contact> &contacts,
+                  u32 &testedPairs) const;
+
+private:
+  StaticBroadPhase m_StaticBroadPhase;
+  std::vector<i32> m_DynamicIds;
+  std::vector<PsuedoBody> m_SortedBodies;
+  std::vector<PsuedoBody> m_Scratch;
+  std::vector<Bounds> m_BodyBounds;
+  std::vector<i32> m_Ranks;
+  SweepBounds m_Sweep;
+  std::vector<u64> m_WorkPrefix;
+  std::vector<i32> m_ChunkStarts;
+  // Per chunk of ranks, then the static contacts
+  std::vector<std::vector<Contact>> m_ChunkContacts;
+  std::vector<u32> m_ChunkTestedPairs;
+  u32 m_TestedPairs{0};
+  u32 m_TestedStaticPairs{0};
+};
@@ -1,5 +1,6 @@
 #include "Contact.hpp"
 #include "Profiler.hpp"
+#include <cstdlib>
 
 void ResolveContact(Contact &contact) {
   HELIX_PROFILER_FUNCTION();
@@ -51,7 +52,7 @@ void ResolveContact(Contact &contact) {
   const Vec3 velTang = vab - velNorm;
   // Get the tangential velocities relative to the other body
   if (glm::length2(velTang) > 1e-6f) {
-    Vec3 relativeVelTang = glm::normalize(relativeVelTang);
+    Vec3 relativeVelTang = glm::normalize(velTang);
     const Vec3 inertiaA =
         glm::cross(invWorldInertiaA * glm::cross(ra, relativeVelTang), ra);
     const Vec3 inertiaB =
@@ -76,3 +77,36 @@ void ResolveContact(Contact &contact) {
     bodyB->transform.SetPosition(bodyB->transform.GetPosition() - (ds * tB));
   }
 }
+
+/*
+====================================================
+ContactPool
+====================================================
+*/
+ContactPool::~ContactPool() { Release(); }
+
+Contact *ContactPool::Allocate(const i32 count) {
+  const i32 needed = m_Count + count;
+  if (needed > m_Capacity) {
+    i32 capacity = m_Capacity > kMinCapacity ? m_Capacity : kMinCapacity;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    // Contacts are plain data, so they can be moved with realloc
+    m_pContacts = static_cast<Contact *>(
+        realloc(m_pContacts, sizeof(Contact) * (size_t)capacity));
+    m_Capacity = capacity;
+    HELIX_PROFILER_PLOT("Contact Pool Capacity", (i64)m_Capacity);
+  }
+  Contact *pContacts = m_pContacts + m_Count;
+  m_Count = needed;
+  m_HighWaterMark = m_Count > m_HighWaterMark ? m_Count : m_HighWaterMark;
+  return pContacts;
+}
+
+void ContactPool::Release() {
+  free(m_pContacts);
+  m_pContacts = nullptr;
+  m_Count = 0;
+  m_Capacity = 0;
+}
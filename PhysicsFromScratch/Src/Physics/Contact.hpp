@@ -13,9 +13,51 @@ struct Contact {
   float separationDistance; // positive when non−penetrating , negative when
                             // penetrating
   float timeOfImpact;
+  // Tells the contacts of one body pair apart from step to step
+  u32 featureId;
 
   Body *bodyA;
   Body *bodyB;
 };
 
 void ResolveContact(Contact &contact);
+
+/*
+====================================================
+ContactPool
+
+Contact storage recycled from step to step. Reset empties it and keeps the
+memory, and Allocate grows it geometrically when a step finds more contacts
+than it has room for, so it settles at the largest step seen instead of
+reserving room for every possible pair up front.
+====================================================
+*/
+class ContactPool {
+public:
+  ContactPool() = default;
+  ContactPool(const ContactPool &) = delete;
+  ContactPool &operator=(const ContactPool &) = delete;
+  ~ContactPool();
+
+  // Starts a new step, the memory is kept
+  void Reset() { m_Count = 0; }
+  // Room for count more contacts after the ones already in the pool. Growing
+  // invalidates pointers returned earlier
+  Contact *Allocate(const i32 count);
+  // Frees the memory
+  void Release();
+
+  Contact *GetContacts() { return m_pContacts; }
+  i32 GetCount() const { return m_Count; }
+  i32 GetCapacity() const { return m_Capacity; }
+  // Most contacts the pool has held at once
+  i32 GetHighWaterMark() const { return m_HighWaterMark; }
+
+private:
+  static constexpr i32 kMinCapacity = 256;
+
+  Contact *m_pContacts{nullptr};
+  i32 m_Count{0};
+  i32 m_Capacity{0};
+  i32 m_HighWaterMark{0};
+};
@@ -0,0 +1,180 @@
+#include "ContactManifold.hpp"
+#include <Profiler.hpp>
+
+// Area spanned by four points, up to a constant, whatever their order
+static f32 GetQuadArea(const Vec3 &p0, const Vec3 &p1, const Vec3 &p2,
+                       const Vec3 &p3) {
+  const f32 a = glm::length2(glm::cross(p0 - p1, p2 - p3));
+  const f32 b = glm::length2(glm::cross(p0 - p2, p1 - p3));
+  const f32 c = glm::length2(glm::cross(p0 - p3, p1 - p2));
+  return glm::max(glm::max(a, b), c);
+}
+
+void ContactManifoldCache::Clear() {
+  m_Manifolds.clear();
+  m_Lookup.Clear();
+}
+
+const ContactManifold *ContactManifoldCache::Find(const i32 a,
+                                                  const i32 b) const {
+  const i32 index = m_Lookup.Find(GetPairKey(a, b));
+  return index != -1 ? &m_Manifolds[index] : nullptr;
+}
+
+i32 ContactManifoldCache::GetPointCount() const {
+  i32 count = 0;
+  for (const ContactManifold &manifold : m_Manifolds) {
+    count += manifold.numPoints;
+  }
+  return count;
+}
+
+void ContactManifoldCache::Refresh(const Body *bodies) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  for (i32 i = (i32)m_Manifolds.size() - 1; i >= 0; i--) {
+    ContactManifold &manifold = m_Manifolds[i];
+    const Body &bodyA = bodies[manifold.bodyA];
+    const Body &bodyB = bodies[manifold.bodyB];
+    const Vec3 centerA = bodyA.GetCenterOfMassWorldSpace();
+    const Vec3 centerB = bodyB.GetCenterOfMassWorldSpace();
+    const Quat &orientationA = bodyA.transform.GetRotation();
+    const Quat &orientationB = bodyB.transform.GetRotation();
+
+    for (i32 j = manifold.numPoints - 1; j >= 0; j--) {
+      ManifoldPoint &point = manifold.points[j];
+      const Vec3 ptOnA = centerA + orientationA * point.ptOnA_LocalSpace;
+      const Vec3 ptOnB = centerB + orientationB * point.ptOnB_LocalSpace;
+      const Vec3 offset = ptOnA - ptOnB;
+      const f32 separation = glm::dot(offset, manifold.normal);
+      const Vec3 drift = offset - manifold.normal * separation;
+      const f32 turnA =
+          glm::dot(orientationA * point.normalOnA_LocalSpace, manifold.normal);
+      const f32 turnB =
+          glm::dot(orientationB * point.normalOnB_LocalSpace, manifold.normal);
+      if (separation > kBreakingDistance ||
+          glm::length2(drift) > kDriftDistance * kDriftDistance ||
+          turnA < kDriftCosAngle || turnB < kDriftCosAngle) {
+        manifold.points[j] = manifold.points[--manifold.numPoints];
+        continue;
+      }
+      point.separation = separation;
+    }
+
+    if (manifold.numPoints == 0) {
+      RemoveManifold(i);
+    }
+  }
+}
+
+void ContactManifoldCache::AddContacts(const Body *bodies,
+                                       const Contact *contacts,
+                                       const i32 num) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  for (i32 i = 0; i < num; i++) {
+    const Contact &contact = contacts[i];
+    const i32 a = (i32)(contact.bodyA - bodies);
+    const i32 b = (i32)(contact.bodyB - bodies);
+    const u64 key = GetPairKey(a, b);
+    i32 index = m_Lookup.Find(key);
+    if (index == -1) {
+      index = (i32)m_Manifolds.size();
+      ContactManifold &manifold = m_Manifolds.emplace_back();
+      manifold.bodyA = a;
+      manifold.bodyB = b;
+      manifold.numPoints = 0;
+      m_Lookup.Set(key, index);
+    }
+    ContactManifold &manifold = m_Manifolds[index];
+
+    // Keep the body order the manifold was created with
+    const bool flipped = manifold.bodyA != a;
+    ManifoldPoint point;
+    point.ptOnA_LocalSpace =
+        flipped ? contact.ptOnB_LocalSpace : contact.ptOnA_LocalSpace;
+    point.ptOnB_LocalSpace =
+        flipped ? contact.ptOnA_LocalSpace : contact.ptOnB_LocalSpace;
+    manifold.normal = flipped ? -contact.normalAB : contact.normalAB;
+    point.normalOnA_LocalSpace =
+        glm::inverse(bodies[manifold.bodyA].transform.GetRotation()) *
+        manifold.normal;
+    point.normalOnB_LocalSpace =
+        glm::inverse(bodies[manifold.bodyB].transform.GetRotation()) *
+        manifold.normal;
+    point.separation = contact.separationDistance;
+    point.featureId = contact.featureId;
+    point.normalImpulse = 0.f;
+    point.tangentImpulse = Vec3(0.f);
+    AddPoint(manifold, point);
+  }
+}
+
+void ContactManifoldCache::AddPoint(ContactManifold &manifold,
+                                    const ManifoldPoint &point) {
+  // The same point seen again keeps the impulses it has built up
+  for (i32 i = 0; i < manifold.numPoints; i++) {
+    ManifoldPoint &existing = manifold.points[i];
+    if (existing.featureId == point.featureId &&
+        glm::length2(existing.ptOnA_LocalSpace - point.ptOnA_LocalSpace) <=
+            kDriftDistance * kDriftDistance) {
+      existing.ptOnA_LocalSpace = point.ptOnA_LocalSpace;
+      existing.ptOnB_LocalSpace = point.ptOnB_LocalSpace;
+      existing.normalOnA_LocalSpace = point.normalOnA_LocalSpace;
+      existing.normalOnB_LocalSpace = point.normalOnB_LocalSpace;
+      existing.separation = point.separation;
+      return;
+    }
+  }
+
+  if (manifold.numPoints < kMaxManifoldPoints) {
+    manifold.points[manifold.numPoints++] = point;
+    return;
+  }
+
+  // Full, so one of the four points or the new one has to go. The deepest
+  // stays, of the rest the one whose loss leaves the largest area goes
+  const ManifoldPoint *candidates[kMaxManifoldPoints + 1];
+  for (i32 i = 0; i < kMaxManifoldPoints; i++) {
+    candidates[i] = &manifold.points[i];
+  }
+  candidates[kMaxManifoldPoints] = &point;
+  i32 deepest = 0;
+  for (i32 i = 1; i <= kMaxManifoldPoints; i++) {
+    if (candidates[i]->separation < candidates[deepest]->separation) {
+      deepest = i;
+    }
+  }
+  i32 removed = -1;
+  f32 largestArea = -1.f;
+  for (i32 i = 0; i <= kMaxManifoldPoints; i++) {
+    if (i == deepest) {
+      continue;
+    }
+    Vec3 kept[kMaxManifoldPoints];
+    i32 numKept = 0;
+    for (i32 j = 0; j <= kMaxManifoldPoints; j++) {
+      if (j != i) {
+        kept[numKept++] = candidates[j]->ptOnA_LocalSpace;
+      }
+    }
+    const f32 area = GetQuadArea(kept[0], kept[1], kept[2], kept[3]);
+    if (area > largestArea) {
+      largestArea = area;
+      removed = i;
+    }
+  }
+  if (removed < kMaxManifoldPoints) {
+    manifold.points[removed] = point;
+  }
+}
+
+void ContactManifoldCache::RemoveManifold(const i32 index) {
+  const ContactManifold &manifold = m_Manifolds[index];
+  m_Lookup.Remove(GetPairKey(manifold.bodyA, manifold.bodyB));
+  const i32 last = (i32)m_Manifolds.size() - 1;
+  if (index != last) {
+    const ContactManifold &moved = m_Manifolds[last];
+    m_Lookup.Set(GetPairKey(moved.bodyA, moved.bodyB), index);
+    m_Manifolds[index] = moved;
+  }
+  m_Manifolds.pop_back();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "Contact.hpp"
+#include "PairHashTable.hpp"
+#include <vector>
+
+static constexpr i32 kMaxManifoldPoints = 4;
+
+struct ManifoldPoint {
+  Vec3 ptOnA_LocalSpace; // Relative to the center of mass, in body space
+  Vec3 ptOnB_LocalSpace;
+  // Manifold normal in the body spaces when the point was found, to tell when
+  // either body has turned under the point
+  Vec3 normalOnA_LocalSpace;
+  Vec3 normalOnB_LocalSpace;
+  f32 separation; // Along the manifold normal, negative when penetrating
+  u32 featureId;
+  // Accumulated by the solver and carried over to the next step
+  f32 normalImpulse;
+  Vec3 tangentImpulse; // Applied to A, B gets the opposite
+};
+
+// Points shared by one body pair
+struct ContactManifold {
+  i32 bodyA;
+  i32 bodyB;
+  Vec3 normal; // From B to A, in world space
+  i32 numPoints;
+  ManifoldPoint points[kMaxManifoldPoints];
+};
+
+/*
+====================================================
+ContactManifoldCache
+
+ContactManifolds that live across steps, one per touching body pair. Refresh
+moves the points along with their bodies and drops the ones that drifted apart
+along the normal, slid along it or were rolled away by either body turning, and
+with them manifolds that have no point left. AddContacts merges the contacts of
+a step into the manifolds: a contact close to a point of the same feature
+updates it in place and keeps its impulses, others are added and a full
+manifold keeps the deepest point and the ones spanning the largest area.
+
+Pairs with a manifold left after Refresh already have their points for the
+step, so the narrowphase can skip them.
+====================================================
+*/
+class ContactManifoldCache {
+public:
+  void Refresh(const Body *bodies);
+  void AddContacts(const Body *bodies, const Contact *contacts, const i32 num);
+  void Clear();
+
+  // nullptr if the pair has no manifold
+  const ContactManifold *Find(const i32 a, const i32 b) const;
+
+  std::vector<ContactManifold> &GetManifolds() { return m_Manifolds; }
+  // Points over all manifolds
+  i32 GetPointCount() const;
+
+private:
+  void AddPoint(ContactManifold &manifold, const ManifoldPoint &point);
+  void RemoveManifold(const i32 index);
+
+private:
+  // Points further apart than this along the normal no longer touch
+  static constexpr f32 kBreakingDistance = 0.02f;
+  // Points that slid further than this along the surface are stale, and
+  // contacts this close to a point are the same point
+  static constexpr f32 kDriftDistance = 0.02f;
+  // Cosine of the angle either body may turn under a point, about 2 degrees
+  static constexpr f32 kDriftCosAngle = 0.9994f;
+
+  std::vector<ContactManifold> m_Manifolds;
+  PairHashTable m_Lookup; // Pair key to index in m_Manifolds
+};
@@ -0,0 +1,285 @@
+#include "ContactSolver.hpp"
+#include "Broadphase.hpp"
+#include <Profiler.hpp>
+#include <bit>
+#include <omp.h>
+
+// Below this many constraints the worker threads cost more than they save
+static constexpr i32 kParallelSolverMinConstraints = 1024;
+
+// Mass the constraint sees along direction, 0 if neither body can move
+static f32 GetEffectiveMass(const f32 invMassA, const f32 invMassB,
+                            const Mat3 &invInertiaA, const Mat3 &invInertiaB,
+                            const Vec3 &rA, const Vec3 &rB,
+                            const Vec3 &direction) {
+  const Vec3 angularA =
+      glm::cross(invInertiaA * glm::cross(rA, direction), rA);
+  const Vec3 angularB =
+      glm::cross(invInertiaB * glm::cross(rB, direction), rB);
+  const f32 k =
+      invMassA + invMassB + glm::dot(angularA + angularB, direction);
+  return k > 0.f ? 1.f / k : 0.f;
+}
+
+// Velocity of the contact point of A relative to the one of B
+static Vec3 GetRelativeVelocity(const Body &bodyA, const Body &bodyB,
+                                const Vec3 &rA, const Vec3 &rB) {
+  return bodyA.linearVelocity + glm::cross(bodyA.angularVelocity, rA) -
+         bodyB.linearVelocity - glm::cross(bodyB.angularVelocity, rB);
+}
+
+void ContactSolver::Solve(Body *bodies, const i32 numBodies,
+                          ContactManifoldCache &manifolds, const f32 dt_Sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  if (dt_Sec <= 0.f) {
+    return;
+  }
+
+  m_InvInertia.resize(numBodies);
+  for (i32 i = 0; i < numBodies; i++) {
+    m_InvInertia[i] = bodies[i].GetInverseInertiaTensorWorldSpace();
+  }
+
+  BuildConstraints(bodies, manifolds.GetManifolds(), dt_Sec);
+  if (m_Parallel) {
+    ColorConstraints(bodies, numBodies);
+  }
+
+  HELIX_PROFILER_ZONE("Solve Velocities", HELIX_PROFILER_COLOR_BARRIER)
+  if (m_Parallel) {
+    // Every thread walks the same colors and iterations, splitting the
+    // constraints of each color between them. The worksharing loops end in a
+    // barrier, so a color only starts once the one before it is done
+    const i32 numConstraints = (i32)m_Constraints.size();
+#pragma omp parallel if (numConstraints >= kParallelSolverMinConstraints)
+    {
+      SolveColors(bodies, true);
+      for (i32 i = 0; i < m_Iterations; i++) {
+        SolveColors(bodies, false);
+      }
+    }
+  } else {
+    for (const ContactConstraint &constraint : m_Constraints) {
+      WarmStartConstraint(bodies, constraint);
+    }
+    for (i32 i = 0; i < m_Iterations; i++) {
+      for (ContactConstraint &constraint : m_Constraints) {
+        SolveConstraint(bodies, constraint);
+      }
+    }
+  }
+  HELIX_PROFILER_ZONE_END()
+  StoreImpulses();
+}
+
+void ContactSolver::BuildConstraints(const Body *bodies,
+                                     std::vector<ContactManifold> &manifolds,
+                                     const f32 dt_Sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Constraints.clear();
+  for (ContactManifold &manifold : manifolds) {
+    const Body &bodyA = bodies[manifold.bodyA];
+    const Body &bodyB = bodies[manifold.bodyB];
+    const Mat3 &invInertiaA = m_InvInertia[manifold.bodyA];
+    const Mat3 &invInertiaB = m_InvInertia[manifold.bodyB];
+    const Vec3 &n = manifold.normal;
+    // Any pair of directions perpendicular to the normal will do, the kept
+    // friction impulse is projected onto them
+    const Vec3 axis = glm::abs(n.x) < 0.57735f ? Vec3(1.f, 0.f, 0.f)
+                                                : Vec3(0.f, 1.f, 0.f);
+    const Vec3 tangent0 = glm::normalize(glm::cross(n, axis));
+    const Vec3 tangent1 = glm::cross(n, tangent0);
+
+    for (i32 i = 0; i < manifold.numPoints; i++) {
+      ManifoldPoint &point = manifold.points[i];
+      ContactConstraint &constraint = m_Constraints.emplace_back();
+      constraint.bodyA = manifold.bodyA;
+      constraint.bodyB = manifold.bodyB;
+      constraint.point = &point;
+
+      // The local points are relative to the centers of mass, turned with the
+      // orientations the bodies have now
+      constraint.rA = bodyA.transform.GetRotation() * point.ptOnA_LocalSpace;
+      constraint.rB = bodyB.transform.GetRotation() * point.ptOnB_LocalSpace;
+      constraint.normal = n;
+      constraint.tangents[0] = tangent0;
+      constraint.tangents[1] = tangent1;
+
+      constraint.normalMass =
+          GetEffectiveMass(bodyA.invMass, bodyB.invMass, invInertiaA,
+                           invInertiaB, constraint.rA, constraint.rB, n);
+      for (i32 j = 0; j < 2; j++) {
+        constraint.tangentMass[j] = GetEffectiveMass(
+            bodyA.invMass, bodyB.invMass, invInertiaA, invInertiaB,
+            constraint.rA, constraint.rB, constraint.tangents[j]);
+      }
+      constraint.friction = bodyA.friction * bodyB.friction;
+
+      if (point.separation > 0.f) {
+        // Not touching yet, the bodies may close the gap but not overshoot it
+        constraint.velocityBias = -point.separation / dt_Sec;
+      } else {
+        constraint.velocityBias =
+            kBaumgarte * glm::max(-point.separation - kPenetrationSlop, 0.f) /
+            dt_Sec;
+        const f32 normalSpeed = glm::dot(
+            GetRelativeVelocity(bodyA, bodyB, constraint.rA, constraint.rB),
+            n);
+        if (normalSpeed < -kRestitutionSpeed) {
+          const f32 elasticity = bodyA.elasticity * bodyB.elasticity;
+          constraint.velocityBias =
+              glm::max(constraint.velocityBias, -elasticity * normalSpeed);
+        }
+      }
+
+      // Carry over the impulses this point ended the last step with
+      constraint.normalImpulse = point.normalImpulse;
+      constraint.tangentImpulse[0] = glm::dot(point.tangentImpulse, tangent0);
+      constraint.tangentImpulse[1] = glm::dot(point.tangentImpulse, tangent1);
+    }
+  }
+}
+
+void ContactSolver::ColorConstraints(const Body *bodies, const i32 numBodies) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  // Greedy coloring in constraint order, each constraint takes the lowest
+  // color neither of its dynamic bodies has yet. Static bodies are only read
+  // by the solver, so any number of constraints of a color may share them
+  const i32 numConstraints = (i32)m_Constraints.size();
+  m_BodyColors.assign(numBodies, 0);
+  m_ConstraintColors.resize(numConstraints);
+  i32 colorCounts[kMaxColors + 1] = {};
+  for (i32 i = 0; i < numConstraints; i++) {
+    const ContactConstraint &constraint = m_Constraints[i];
+    const bool dynamicA = !IsStaticBody(&bodies[constraint.bodyA]);
+    const bool dynamicB = !IsStaticBody(&bodies[constraint.bodyB]);
+    const u64 used = (dynamicA ? m_BodyColors[constraint.bodyA] : 0) |
+                     (dynamicB ? m_BodyColors[constraint.bodyB] : 0);
+    const i32 color = used == ~0ull ? kMaxColors : std::countr_zero(~used);
+    if (color < kMaxColors) {
+      const u64 bit = 1ull << color;
+      m_BodyColors[constraint.bodyA] |= dynamicA ? bit : 0;
+      m_BodyColors[constraint.bodyB] |= dynamicB ? bit : 0;
+    }
+    m_ConstraintColors[i] = (u8)color;
+    colorCounts[color]++;
+  }
+
+  // Group the constraints by color, keeping their order within a color, and
+  // leave out the empty colors so no thread waits at a barrier for nothing
+  i32 colorOffsets[kMaxColors + 1];
+  i32 offset = 0;
+  m_ColorStarts.clear();
+  for (i32 color = 0; color <= kMaxColors; color++) {
+    colorOffsets[color] = offset;
+    if (color < kMaxColors && colorCounts[color] > 0) {
+      m_ColorStarts.push_back(offset);
+    }
+    offset += colorCounts[color];
+  }
+  m_OverflowStart = colorOffsets[kMaxColors];
+  m_ColorStarts.push_back(m_OverflowStart);
+
+  m_ColoredConstraints.resize(numConstraints);
+  for (i32 i = 0; i < numConstraints; i++) {
+    m_ColoredConstraints[colorOffsets[m_ConstraintColors[i]]++] =
+        m_Constraints[i];
+  }
+  m_Constraints.swap(m_ColoredConstraints);
+  HELIX_PROFILER_PLOT("Solver Colors", (i64)m_ColorStarts.size() - 1);
+}
+
+void ContactSolver::SolveColors(Body *bodies, const bool warmStart) {
+  const i32 numColors = (i32)m_ColorStarts.size() - 1;
+  for (i32 color = 0; color < numColors; color++) {
+#pragma omp for schedule(static)
+    for (i32 i = m_ColorStarts[color]; i < m_ColorStarts[color + 1]; i++) {
+      if (warmStart) {
+        WarmStartConstraint(bodies, m_Constraints[i]);
+      } else {
+        SolveConstraint(bodies, m_Constraints[i]);
+      }
+    }
+  }
+
+  // Constraints that found no free color share bodies with any other, they
+  // run on one thread after the rest
+#pragma omp single
+  for (i32 i = m_OverflowStart; i < (i32)m_Constraints.size(); i++) {
+    if (warmStart) {
+      WarmStartConstraint(bodies, m_Constraints[i]);
+    } else {
+      SolveConstraint(bodies, m_Constraints[i]);
+    }
+  }
+}
+
+void ContactSolver::ApplyImpulse(Body *bodies,
+                                 const ContactConstraint &constraint,
+                                 const Vec3 &impulse) {
+  // Static bodies are never written, constraints solved at the same time on
+  // other threads may be reading them
+  Body &bodyA = bodies[constraint.bodyA];
+  Body &bodyB = bodies[constraint.bodyB];
+  if (!IsStaticBody(&bodyA)) {
+    bodyA.linearVelocity += impulse * bodyA.invMass;
+    bodyA.angularVelocity +=
+        m_InvInertia[constraint.bodyA] * glm::cross(constraint.rA, impulse);
+  }
+  if (!IsStaticBody(&bodyB)) {
+    bodyB.linearVelocity -= impulse * bodyB.invMass;
+    bodyB.angularVelocity -=
+        m_InvInertia[constraint.bodyB] * glm::cross(constraint.rB, impulse);
+  }
+}
+
+void ContactSolver::WarmStartConstraint(Body *bodies,
+                                        const ContactConstraint &constraint) {
+  ApplyImpulse(bodies, constraint,
+               constraint.normal * constraint.normalImpulse +
+                   constraint.tangents[0] * constraint.tangentImpulse[0] +
+                   constraint.tangents[1] * constraint.tangentImpulse[1]);
+}
+
+void ContactSolver::SolveConstraint(Body *bodies,
+                                    ContactConstraint &constraint) {
+  const Body &bodyA = bodies[constraint.bodyA];
+  const Body &bodyB = bodies[constraint.bodyB];
+
+  // Friction first, bounded by the normal impulse of the last iteration
+  const f32 maxFriction = constraint.friction * constraint.normalImpulse;
+  for (i32 j = 0; j < 2; j++) {
+    const Vec3 &tangent = constraint.tangents[j];
+    const f32 tangentSpeed = glm::dot(
+        GetRelativeVelocity(bodyA, bodyB, constraint.rA, constraint.rB),
+        tangent);
+    const f32 oldImpulse = constraint.tangentImpulse[j];
+    constraint.tangentImpulse[j] =
+        glm::clamp(oldImpulse - constraint.tangentMass[j] * tangentSpeed,
+                   -maxFriction, maxFriction);
+    ApplyImpulse(bodies, constraint,
+                 tangent * (constraint.tangentImpulse[j] - oldImpulse));
+  }
+
+  // The accumulated normal impulse can only push the bodies apart
+  const f32 normalSpeed = glm::dot(
+      GetRelativeVelocity(bodyA, bodyB, constraint.rA, constraint.rB),
+      constraint.normal);
+  const f32 oldImpulse = constraint.normalImpulse;
+  constraint.normalImpulse = glm::max(
+      oldImpulse -
+          constraint.normalMass * (normalSpeed - constraint.velocityBias),
+      0.f);
+  ApplyImpulse(bodies, constraint,
+               constraint.normal * (constraint.normalImpulse - oldImpulse));
+}
+
+void ContactSolver::StoreImpulses() {
+  for (const ContactConstraint &constraint : m_Constraints) {
+    ManifoldPoint &point = *constraint.point;
+    point.normalImpulse = constraint.normalImpulse;
+    point.tangentImpulse =
+        constraint.tangents[0] * constraint.tangentImpulse[0] +
+        constraint.tangents[1] * constraint.tangentImpulse[1];
+  }
+}
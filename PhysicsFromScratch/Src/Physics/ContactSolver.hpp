@@ -0,0 +1,96 @@
+#pragma once
+#include "ContactManifold.hpp"
+#include <vector>
+
+/*
+====================================================
+ContactSolver
+
+Sequential impulse solver for the contact manifolds of a step. Solve turns every
+manifold point into a non-penetration constraint with two friction directions,
+applies the impulses the point ended the last step with, then runs a fixed
+number of velocity iterations in which each constraint corrects the relative
+velocity at its point. The accumulated impulses are clamped rather than the
+ones of each iteration, so a constraint can take back what it pushed too hard
+earlier.
+
+Points that have not touched yet are speculative: they let the bodies close
+the gap within the step and no further. Penetration is pushed out by a velocity
+bias and bounces only happen above kRestitutionSpeed, so resting bodies settle
+instead of jittering. The final impulses are written back to the manifold
+points for the next step. Solve only changes velocities, the bodies are moved by
+the caller afterwards.
+
+In parallel mode the constraints are colored first so that no two of a color
+touch the same dynamic body. A color is split between the worker threads
+without locks and the next one starts once it is done.
+====================================================
+*/
+class ContactSolver {
+public:
+  void Solve(Body *bodies, const i32 numBodies,
+             ContactManifoldCache &manifolds, const f32 dt_Sec);
+
+  void SetIterations(const i32 iterations) { m_Iterations = iterations; }
+  i32 GetIterations() const { return m_Iterations; }
+  // Solves the constraints color by color on worker threads. The colors fix
+  // the order, so the result does not depend on the number of threads, but it
+  // differs from the serial solver, which goes in manifold order
+  void SetParallel(const bool parallel) { m_Parallel = parallel; }
+  bool IsParallel() const { return m_Parallel; }
+
+private:
+  struct ContactConstraint {
+    i32 bodyA;
+    i32 bodyB;
+    ManifoldPoint *point; // Keeps the impulses between steps
+    Vec3 rA; // Contact point relative to the centers of mass
+    Vec3 rB;
+    Vec3 normal; // From B to A
+    Vec3 tangents[2];
+    f32 normalMass; // Effective mass along each direction
+    f32 tangentMass[2];
+    f32 velocityBias; // Normal velocity the constraint aims for
+    f32 friction;
+    f32 normalImpulse; // Accumulated over the step
+    f32 tangentImpulse[2];
+  };
+
+  void BuildConstraints(const Body *bodies,
+                        std::vector<ContactManifold> &manifolds,
+                        const f32 dt_Sec);
+  // Sorts m_Constraints into colors that share no dynamic body
+  void ColorConstraints(const Body *bodies, const i32 numBodies);
+  // One pass over every color, called by each thread of a parallel region
+  void SolveColors(Body *bodies, const bool warmStart);
+  // Applies impulse to A and the opposite to B
+  void ApplyImpulse(Body *bodies, const ContactConstraint &constraint,
+                    const Vec3 &impulse);
+  void WarmStartConstraint(Body *bodies, const ContactConstraint &constraint);
+  void SolveConstraint(Body *bodies, ContactConstraint &constraint);
+  void StoreImpulses();
+
+private:
+  // Penetration left alone so touching bodies keep touching
+  static constexpr f32 kPenetrationSlop = 0.01f;
+  // Share of the penetration pushed out per step
+  static constexpr f32 kBaumgarte = 0.2f;
+  // Slower approaches come to rest instead of bouncing
+  static constexpr f32 kRestitutionSpeed = 1.f;
+  static constexpr i32 kDefaultIterations = 10;
+  // One bit per color in m_BodyColors, constraints that find them all taken
+  // go to a last batch solved on a single thread
+  static constexpr i32 kMaxColors = 64;
+
+  i32 m_Iterations{kDefaultIterations};
+  bool m_Parallel{false};
+  std::vector<ContactConstraint> m_Constraints;
+  std::vector<Mat3> m_InvInertia; // World space, per body
+
+  std::vector<u64> m_BodyColors; // Colors taken by each dynamic body
+  std::vector<u8> m_ConstraintColors;
+  std::vector<ContactConstraint> m_ColoredConstraints;
+  // First constraint of every non-empty color, then m_OverflowStart
+  std::vector<i32> m_ColorStarts;
+  i32 m_OverflowStart{0}; // Constraints from here on found no free color
+};
@@ -0,0 +1,348 @@
+#include "DynamicAABBTree.hpp"
+#include <Assert.hpp>
+
+static inline Bounds Combine(const Bounds &a, const Bounds &b) {
+  Bounds bounds;
+  bounds.mins = glm::min(a.mins, b.mins);
+  bounds.maxs = glm::max(a.maxs, b.maxs);
+  return bounds;
+}
+
+// Half the surface area, used as the insertion cost
+static inline f32 GetPerimeter(const Bounds &bounds) {
+  const f32 wx = bounds.WidthX();
+  const f32 wy = bounds.WidthY();
+  const f32 wz = bounds.WidthZ();
+  return wx * wy + wy * wz + wz * wx;
+}
+
+bool RayIntersectsBounds(const Vec3 &rayStart, const Vec3 &invRayDir,
+                         const Bounds &bounds, const f32 maxT, f32 &tMin) {
+  const Vec3 t0 = (bounds.mins - rayStart) * invRayDir;
+  const Vec3 t1 = (bounds.maxs - rayStart) * invRayDir;
+  const Vec3 tNear = glm::min(t0, t1);
+  const Vec3 tFar = glm::max(t0, t1);
+
+  tMin = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.f));
+  const f32 tMax = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxT));
+  return tMin <= tMax;
+}
+
+DynamicAABBTree::DynamicAABBTree() { Clear(); }
+
+void DynamicAABBTree::Clear() {
+  m_Nodes.clear();
+  m_Root = AABB_NULL_NODE;
+  m_FreeList = AABB_NULL_NODE;
+  m_ProxyCount = 0;
+}
+
+i32 DynamicAABBTree::AllocateNode() {
+  if (m_FreeList == AABB_NULL_NODE) {
+    // Grow the pool and thread the new nodes onto the free list
+    const i32 oldCapacity = (i32)m_Nodes.size();
+    const i32 newCapacity = oldCapacity == 0 ? 16 : oldCapacity * 2;
+    m_Nodes.resize(newCapacity);
+    for (i32 i = oldCapacity; i < newCapacity - 1; i++) {
+      m_Nodes[i].next = i + 1;
+      m_Nodes[i].height = -1;
+    }
+    m_Nodes[newCapacity - 1].next = AABB_NULL_NODE;
+    m_Nodes[newCapacity - 1].height = -1;
+    m_FreeList = oldCapacity;
+  }
+
+  const i32 nodeId = m_FreeList;
+  TreeNode &node = m_Nodes[nodeId];
+  m_FreeList = node.next;
+  node.parent = AABB_NULL_NODE;
+  node.child1 = AABB_NULL_NODE;
+  node.child2 = AABB_NULL_NODE;
+  node.height = 0;
+  node.userData = -1;
+  return nodeId;
+}
+
+void DynamicAABBTree::FreeNode(const i32 nodeId) {
+  m_Nodes[nodeId].next = m_FreeList;
+  m_Nodes[nodeId].height = -1;
+  m_FreeList = nodeId;
+}
+
+i32 DynamicAABBTree::CreateProxy(const Bounds &bounds, const i32 userData,
+                                 const f32 margin) {
+  const i32 proxyId = AllocateNode();
+  TreeNode &node = m_Nodes[proxyId];
+  node.bounds.mins = bounds.mins - Vec3(margin);
+  node.bounds.maxs = bounds.maxs + Vec3(margin);
+  node.userData = userData;
+
+  InsertLeaf(proxyId);
+  m_ProxyCount++;
+  return proxyId;
+}
+
+void DynamicAABBTree::DestroyProxy(const i32 proxyId) {
+  HASSERT(m_Nodes[proxyId].IsLeaf());
+  RemoveLeaf(proxyId);
+  FreeNode(proxyId);
+  m_ProxyCount--;
+}
+
+bool DynamicAABBTree::MoveProxy(const i32 proxyId, const Bounds &bounds,
+                                const f32 margin) {
+  HASSERT(m_Nodes[proxyId].IsLeaf());
+  const Bounds &fatBounds = m_Nodes[proxyId].bounds;
+  if (fatBounds.Contains(bounds)) {
+    // Still inside the fat box, also shrink boxes that became much too large
+    // so a body that slowed down does not keep a huge box around
+    Bounds hugeBounds;
+    hugeBounds.mins = bounds.mins - Vec3(margin * 4.f);
+    hugeBounds.maxs = bounds.maxs + Vec3(margin * 4.f);
+    if (hugeBounds.Contains(fatBounds)) {
+      return false;
+    }
+  }
+
+  RemoveLeaf(proxyId);
+  m_Nodes[proxyId].bounds.mins = bounds.mins - Vec3(margin);
+  m_Nodes[proxyId].bounds.maxs = bounds.maxs + Vec3(margin);
+  InsertLeaf(proxyId);
+  return true;
+}
+
+i32 DynamicAABBTree::GetHeight() const {
+  if (m_Root == AABB_NULL_NODE) {
+    return 0;
+  }
+  return m_Nodes[m_Root].height;
+}
+
+void DynamicAABBTree::InsertLeaf(const i32 leaf) {
+  if (m_Root == AABB_NULL_NODE) {
+    m_Root = leaf;
+    m_Nodes[m_Root].parent = AABB_NULL_NODE;
+    return;
+  }
+
+  // Walk down to the sibling that gives the cheapest insertion, using the
+  // surface area of the new parent plus the growth of the ancestors
+  const Bounds leafBounds = m_Nodes[leaf].bounds;
+  i32 index = m_Root;
+  while (!m_Nodes[index].IsLeaf()) {
+    const TreeNode &node = m_Nodes[index];
+    const i32 child1 = node.child1;
+    const i32 child2 = node.child2;
+
+    const f32 area = GetPerimeter(node.bounds);
+    const f32 combinedArea = GetPerimeter(Combine(node.bounds, leafBounds));
+
+    // Cost of creating a new parent for this node and the new leaf
+    const f32 cost = 2.f * combinedArea;
+    // Minimum cost of pushing the leaf further down the tree
+    const f32 inheritanceCost = 2.f * (combinedArea - area);
+
+    auto descendCost = [&](const i32 child) {
+      const Bounds combined = Combine(leafBounds, m_Nodes[child].bounds);
+      if (m_Nodes[child].IsLeaf()) {
+        return GetPerimeter(combined) + inheritanceCost;
+      }
+      return GetPerimeter(combined) - GetPerimeter(m_Nodes[child].bounds) +
+             inheritanceCost;
+    };
+    const f32 cost1 = descendCost(child1);
+    const f32 cost2 = descendCost(child2);
+
+    if (cost < cost1 && cost < cost2) {
+      break;
+    }
+    index = cost1 < cost2 ? child1 : child2;
+  }
+
+  // Create a new parent for the sibling and the leaf
+  const i32 sibling = index;
+  const i32 oldParent = m_Nodes[sibling].parent;
+  const i32 newParent = AllocateNode();
+  m_Nodes[newParent].parent = oldParent;
+  m_Nodes[newParent].bounds = Combine(leafBounds, m_Nodes[sibling].bounds);
+  m_Nodes[newParent].height = m_Nodes[sibling].height + 1;
+  m_Nodes[newParent].child1 = sibling;
+  m_Nodes[newParent].child2 = leaf;
+  m_Nodes[sibling].parent = newParent;
+  m_Nodes[leaf].parent = newParent;
+
+  if (oldParent != AABB_NULL_NODE) {
+    if (m_Nodes[oldParent].child1 == sibling) {
+      m_Nodes[oldParent].child1 = newParent;
+    } else {
+      m_Nodes[oldParent].child2 = newParent;
+    }
+  } else {
+    m_Root = newParent;
+  }
+
+  // Walk back up fixing heights and bounds
+  index = m_Nodes[leaf].parent;
+  while (index != AABB_NULL_NODE) {
+    index = Balance(index);
+
+    TreeNode &node = m_Nodes[index];
+    node.height = 1 + glm::max(m_Nodes[node.child1].height,
+                               m_Nodes[node.child2].height);
+    node.bounds =
+        Combine(m_Nodes[node.child1].bounds, m_Nodes[node.child2].bounds);
+
+    index = node.parent;
+  }
+}
+
+void DynamicAABBTree::RemoveLeaf(const i32 leaf) {
+  if (leaf == m_Root) {
+    m_Root = AABB_NULL_NODE;
+    return;
+  }
+
+  const i32 parent = m_Nodes[leaf].parent;
+  const i32 grandParent = m_Nodes[parent].parent;
+  const i32 sibling = m_Nodes[parent].child1 == leaf ? m_Nodes[parent].child2
+                                                     : m_Nodes[parent].child1;
+
+  if (grandParent == AABB_NULL_NODE) {
+    m_Root = sibling;
+    m_Nodes[sibling].parent = AABB_NULL_NODE;
+    FreeNode(parent);
+    return;
+  }
+
+  // Destroy the parent and connect the sibling to the grand parent
+  if (m_Nodes[grandParent].child1 == parent) {
+    m_Nodes[grandParent].child1 = sibling;
+  } else {
+    m_Nodes[grandParent].child2 = sibling;
+  }
+  m_Nodes[sibling].parent = grandParent;
+  FreeNode(parent);
+
+  i32 index = grandParent;
+  while (index != AABB_NULL_NODE) {
+    index = Balance(index);
+
+    TreeNode &node = m_Nodes[index];
+    node.bounds =
+        Combine(m_Nodes[node.child1].bounds, m_Nodes[node.child2].bounds);
+    node.height = 1 + glm::max(m_Nodes[node.child1].height,
+                               m_Nodes[node.child2].height);
+
+    index = node.parent;
+  }
+}
+
+// Performs a left or right rotation if node A is imbalanced and returns the
+// new root of the subtree
+i32 DynamicAABBTree::Balance(const i32 iA) {
+  TreeNode *A = &m_Nodes[iA];
+  if (A->IsLeaf() || A->height < 2) {
+    return iA;
+  }
+
+  const i32 iB = A->child1;
+  const i32 iC = A->child2;
+  TreeNode *B = &m_Nodes[iB];
+  TreeNode *C = &m_Nodes[iC];
+
+  const i32 balance = C->height - B->height;
+
+  // Rotate C up
+  if (balance > 1) {
+    const i32 iF = C->child1;
+    const i32 iG = C->child2;
+    TreeNode *F = &m_Nodes[iF];
+    TreeNode *G = &m_Nodes[iG];
+
+    // Swap A and C
+    C->child1 = iA;
+    C->parent = A->parent;
+    A->parent = iC;
+
+    // A's old parent should point to C
+    if (C->parent != AABB_NULL_NODE) {
+      if (m_Nodes[C->parent].child1 == iA) {
+        m_Nodes[C->parent].child1 = iC;
+      } else {
+        m_Nodes[C->parent].child2 = iC;
+      }
+    } else {
+      m_Root = iC;
+    }
+
+    // Rotate
+    if (F->height > G->height) {
+      C->child2 = iF;
+      A->child2 = iG;
+      G->parent = iA;
+      A->bounds = Combine(B->bounds, G->bounds);
+      C->bounds = Combine(A->bounds, F->bounds);
+
+      A->height = 1 + glm::max(B->height, G->height);
+      C->height = 1 + glm::max(A->height, F->height);
+    } else {
+      C->child2 = iG;
+      A->child2 = iF;
+      F->parent = iA;
+      A->bounds = Combine(B->bounds, F->bounds);
+      C->bounds = Combine(A->bounds, G->bounds);
+
+      A->height = 1 + glm::max(B->height, F->height);
+      C->height = 1 + glm::max(A->height, G->height);
+    }
+    return iC;
+  }
+
+  // Rotate B up
+  if (balance < -1) {
+    const i32 iD = B->child1;
+    const i32 iE = B->child2;
+    TreeNode *D = &m_Nodes[iD];
+    TreeNode *E = &m_Nodes[iE];
+
+    // Swap A and B
+    B->child1 = iA;
+    B->parent = A->parent;
+    A->parent = iB;
+
+    // A's old parent should point to B
+    if (B->parent != AABB_NULL_NODE) {
+      if (m_Nodes[B->parent].child1 == iA) {
+        m_Nodes[B->parent].child1 = iB;
+      } else {
+        m_Nodes[B->parent].child2 = iB;
+      }
+    } else {
+      m_Root = iB;
+    }
+
+    // Rotate
+    if (D->height > E->height) {
+      B->child2 = iD;
+      A->child1 = iE;
+      E->parent = iA;
+      A->bounds = Combine(C->bounds, E->bounds);
+      B->bounds = Combine(A->bounds, D->bounds);
+
+      A->height = 1 + glm::max(C->height, E->height);
+      B->height = 1 + glm::max(A->height, D->height);
+    } else {
+      B->child2 = iE;
+      A->child1 = iD;
+      D->parent = iA;
+      A->bounds = Combine(C->bounds, D->bounds);
+      B->bounds = Combine(A->bounds, E->bounds);
+
+      A->height = 1 + glm::max(C->height, D->height);
+      B->height = 1 + glm::max(A->height, E->height);
+    }
+    return iB;
+  }
+
+  return iA;
+}
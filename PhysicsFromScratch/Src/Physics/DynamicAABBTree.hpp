@@ -0,0 +1,196 @@
+#pragma once
+#include "Bounds.hpp"
+#include <vector>
+
+#define AABB_NULL_NODE -1
+
+struct TreeNode {
+  bool IsLeaf() const { return child1 == AABB_NULL_NODE; }
+
+  Bounds bounds; // Fat bounds
+  union {
+    i32 parent;
+    i32 next; // Free list
+  };
+  i32 child1;
+  i32 child2;
+  i32 height; // Leaf = 0, free node = -1
+  i32 userData;
+};
+
+/*
+====================================================
+DynamicAABBTree
+
+Bounding volume hierarchy with one leaf per proxy. Leaves store fat bounds so a
+proxy is only re-inserted when it leaves its fat box, and the tree is kept
+balanced with rotations as leaves are inserted and removed.
+====================================================
+*/
+class DynamicAABBTree {
+public:
+  DynamicAABBTree();
+
+  // Returns the proxy id. The bounds stored in the tree are enlarged by margin
+  i32 CreateProxy(const Bounds &bounds, const i32 userData, const f32 margin);
+  void DestroyProxy(const i32 proxyId);
+  // Re-inserts the proxy if bounds is no longer contained in its fat bounds.
+  // Returns true if the proxy was re-inserted
+  bool MoveProxy(const i32 proxyId, const Bounds &bounds, const f32 margin);
+  void Clear();
+
+  i32 GetUserData(const i32 proxyId) const {
+    return m_Nodes[proxyId].userData;
+  }
+  const Bounds &GetFatBounds(const i32 proxyId) const {
+    return m_Nodes[proxyId].bounds;
+  }
+  i32 GetHeight() const;
+  i32 GetProxyCount() const { return m_ProxyCount; }
+  // For custom traversals, AABB_NULL_NODE when the tree is empty
+  i32 GetRoot() const { return m_Root; }
+  const std::vector<TreeNode> &GetNodes() const { return m_Nodes; }
+
+  // callback(i32 userData) -> bool, return false to stop the query
+  template <typename T> void Query(const Bounds &bounds, T &&callback) const;
+
+  // callback(i32 userData, f32 maxT) -> f32. Return the new maximum distance
+  // along the ray to clip it, maxT to keep going or 0 to stop. rayDir does
+  // not have to be normalized, distances are in units of rayDir
+  template <typename T>
+  void RayCast(const Vec3 &rayStart, const Vec3 &rayDir, f32 maxT,
+               T &&callback) const;
+
+  // Reports every pair of leaves whose fat bounds overlap by traversing the
+  // tree against itself. callback(i32 userDataA, i32 userDataB)
+  template <typename T> void QueryPairs(T &&callback) const;
+
+private:
+  i32 AllocateNode();
+  void FreeNode(const i32 nodeId);
+  void InsertLeaf(const i32 leaf);
+  void RemoveLeaf(const i32 leaf);
+  i32 Balance(const i32 nodeId);
+
+  template <typename T>
+  void QueryCross(i32 nodeA, i32 nodeB, T &callback,
+                  std::vector<std::pair<i32, i32>> &stack) const;
+
+private:
+  std::vector<TreeNode> m_Nodes;
+  i32 m_Root{AABB_NULL_NODE};
+  i32 m_FreeList{AABB_NULL_NODE};
+  i32 m_ProxyCount{0};
+};
+
+// Slab test, returns the entry distance in units of rayDir through tMin
+bool RayIntersectsBounds(const Vec3 &rayStart, const Vec3 &invRayDir,
+                         const Bounds &bounds, const f32 maxT, f32 &tMin);
+
+template <typename T>
+void DynamicAABBTree::Query(const Bounds &bounds, T &&callback) const {
+  if (m_Root == AABB_NULL_NODE) {
+    return;
+  }
+
+  i32 stack[256];
+  i32 stackCount = 0;
+  stack[stackCount++] = m_Root;
+  while (stackCount > 0) {
+    const TreeNode &node = m_Nodes[stack[--stackCount]];
+    if (!node.bounds.DoesIntersect(bounds)) {
+      continue;
+    }
+
+    if (node.IsLeaf()) {
+      if (!callback(node.userData)) {
+        return;
+      }
+    } else {
+      stack[stackCount++] = node.child1;
+      stack[stackCount++] = node.child2;
+    }
+  }
+}
+
+template <typename T>
+void DynamicAABBTree::RayCast(const Vec3 &rayStart, const Vec3 &rayDir,
+                              f32 maxT, T &&callback) const {
+  if (m_Root == AABB_NULL_NODE) {
+    return;
+  }
+
+  const Vec3 invRayDir = 1.f / rayDir;
+
+  i32 stack[256];
+  i32 stackCount = 0;
+  stack[stackCount++] = m_Root;
+  while (stackCount > 0) {
+    const TreeNode &node = m_Nodes[stack[--stackCount]];
+    f32 tEnter;
+    if (!RayIntersectsBounds(rayStart, invRayDir, node.bounds, maxT, tEnter)) {
+      continue;
+    }
+
+    if (node.IsLeaf()) {
+      const f32 t = callback(node.userData, maxT);
+      if (t == 0.f) {
+        return;
+      }
+      maxT = t;
+    } else {
+      stack[stackCount++] = node.child1;
+      stack[stackCount++] = node.child2;
+    }
+  }
+}
+
+template <typename T> void DynamicAABBTree::QueryPairs(T &&callback) const {
+  if (m_Root == AABB_NULL_NODE) {
+    return;
+  }
+
+  // Every internal node pairs its two subtrees against each other, which
+  // visits each overlapping pair of leaves exactly once
+  std::vector<std::pair<i32, i32>> crossStack;
+  i32 stack[256];
+  i32 stackCount = 0;
+  stack[stackCount++] = m_Root;
+  while (stackCount > 0) {
+    const TreeNode &node = m_Nodes[stack[--stackCount]];
+    if (node.IsLeaf()) {
+      continue;
+    }
+    QueryCross(node.child1, node.child2, callback, crossStack);
+    stack[stackCount++] = node.child1;
+    stack[stackCount++] = node.child2;
+  }
+}
+
+template <typename T>
+void DynamicAABBTree::QueryCross(i32 nodeA, i32 nodeB, T &callback,
+                                 std::vector<std::pair<i32, i32>> &stack) const {
+  stack.clear();
+  stack.push_back({nodeA, nodeB});
+  while (!stack.empty()) {
+    const std::pair<i32, i32> top = stack.back();
+    stack.pop_back();
+
+    const TreeNode &a = m_Nodes[top.first];
+    const TreeNode &b = m_Nodes[top.second];
+    if (!a.bounds.DoesIntersect(b.bounds)) {
+      continue;
+    }
+
+    if (a.IsLeaf() && b.IsLeaf()) {
+      callback(a.userData, b.userData);
+    } else if (b.IsLeaf() || (!a.IsLeaf() && a.height >= b.height)) {
+      // Descend into the taller subtree
+      stack.push_back({a.child1, top.second});
+      stack.push_back({a.child2, top.second});
+    } else {
+      stack.push_back({top.first, b.child1});
+      stack.push_back({top.first, b.child2});
+    }
+  }
+}
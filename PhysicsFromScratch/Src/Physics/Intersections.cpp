@@ -1,47 +1,32 @@
 
 #include "Intersections.hpp"
+#include "SimdLanes.hpp"
+#include <Profiler.hpp>
 
-bool SphereSphereDynamic(const f32 radiusA, const f32 radiusB, const Vec3 &posA,
-                         const Vec3 &posB, const Vec3 &velA, const Vec3 &velB,
-                         const f32 dt, Vec3 &ptOnA, Vec3 &ptOnB, f32 &toi);
-
-bool Intersect(Body *bodyA, Body *bodyB, f32 dt_Sec, Contact &contact) {
-  // TODO: Only spheres for now
-  // TODO: Also Try to reduce how often you call getter and setter functions
-  Vec3 positionA = bodyA->transform.GetPosition();
-  Vec3 positionB = bodyB->transform.GetPosition();
-  if (SphereSphereDynamic(bodyA->transform.GetScale().x,
-                          bodyB->transform.GetScale().x, positionA, positionB,
-                          bodyA->linearVelocity, bodyB->linearVelocity, dt_Sec,
-                          contact.ptOnA_WorldSpace, contact.ptOnB_WorldSpace,
-                          contact.timeOfImpact)) {
-    bodyA->transform.SetPosition(positionA);
-    bodyB->transform.SetPosition(positionB);
-
-    contact.bodyA = bodyA;
-    contact.bodyB = bodyB;
-    // Step bodies forward to get local space collision points
-    bodyA->Update(contact.timeOfImpact);
-    bodyB->Update(contact.timeOfImpact);
-    // Convert world space contacts to local space
-    contact.ptOnA_LocalSpace =
-        bodyA->WorldSpaceToBodySpace(contact.ptOnA_WorldSpace);
-    contact.ptOnB_LocalSpace =
-        bodyB->WorldSpaceToBodySpace(contact.ptOnB_WorldSpace);
-    contact.normalAB = bodyA->transform.GetPosition() -
-                       bodyB->transform.GetPosition(); // TODO: Change to BA?
-    contact.normalAB = glm::normalize(contact.normalAB);
-    // Unwind time step
-    bodyA->Update(-contact.timeOfImpact);
-    bodyB->Update(-contact.timeOfImpact);
-    // Calculate the separation distance
-    Vec3 ab = bodyB->transform.GetPosition() - bodyA->transform.GetPosition();
-    float r = glm::length(ab) -
-              (bodyA->transform.GetScale().x + bodyB->transform.GetScale().x);
-    contact.separationDistance = r;
-    return true;
-  }
-  return false;
+void FinishContact(Contact &contact) {
+  const Body *bodyA = contact.bodyA;
+  const Body *bodyB = contact.bodyB;
+  // Convert the contact points to local space with the poses the bodies will
+  // have at the time of impact
+  const BodyPose poseA = bodyA->PredictPose(contact.timeOfImpact);
+  const BodyPose poseB = bodyB->PredictPose(contact.timeOfImpact);
+  contact.ptOnA_LocalSpace = glm::inverse(poseA.orientation) *
+                             (contact.ptOnA_WorldSpace - poseA.centerOfMass);
+  contact.ptOnB_LocalSpace = glm::inverse(poseB.orientation) *
+                             (contact.ptOnB_WorldSpace - poseB.centerOfMass);
+  contact.normalAB =
+      glm::normalize(poseA.position - poseB.position); // TODO: Change to BA?
+  // Calculate the separation distance
+  contact.separationDistance = GetSeparation(bodyA, bodyB);
+  // Spheres touch at a single point
+  contact.featureId = 0;
+}
+
+f32 GetSeparation(const Body *bodyA, const Body *bodyB) {
+  const Vec3 ab =
+      bodyB->transform.GetPosition() - bodyA->transform.GetPosition();
+  return glm::length(ab) -
+         (bodyA->transform.GetScale().x + bodyB->transform.GetScale().x);
 }
 
 bool RaySphere(const Vec3 &rayStart, const Vec3 &rayDir,
@@ -102,6 +87,15 @@ bool SphereSphereDynamic(const f32 radiusA, const f32 radiusB, const Vec3 &posA,
     return false;
   }
   // Get the points on the respective points of collision and return true
+  SphereContactPoints(radiusA, radiusB, posA, posB, velA, velB, toi, ptOnA,
+                      ptOnB);
+  return true;
+}
+
+void SphereContactPoints(const f32 radiusA, const f32 radiusB,
+                         const Vec3 &posA, const Vec3 &posB, const Vec3 &velA,
+                         const Vec3 &velB, const f32 toi, Vec3 &ptOnA,
+                         Vec3 &ptOnB) {
   Vec3 newPosA = posA + velA * toi;
   Vec3 newPosB = posB + velB * toi;
   Vec3 ab = newPosB - newPosA;
@@ -110,6 +104,106 @@ bool SphereSphereDynamic(const f32 radiusA, const f32 radiusB, const Vec3 &posA,
 
   ptOnA = newPosA + ab * radiusA;
   ptOnB = newPosB - ab * radiusB;
+}
 
-  return true;
+void SphereSphereDynamicBatch(const Body *bodies, const CollisionPair *pairs,
+                              const i32 count, const f32 dt,
+                              SweptSphereResults &results) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  results.hits.resize(count);
+  results.toi.resize(count);
+  results.separations.resize(count);
+  i32 numHits = 0;
+
+  alignas(32) f32 lanes[14][kNumLanes];
+  alignas(32) f32 toiLanes[kNumLanes];
+  alignas(32) f32 separationLanes[kNumLanes];
+  for (i32 first = 0; first < count; first += kNumLanes) {
+    // Gather the block into lanes. A partial block repeats its last pair and
+    // masks the repeats out of the hits
+    const i32 numValid = count - first < kNumLanes ? count - first : kNumLanes;
+    for (i32 lane = 0; lane < kNumLanes; lane++) {
+      const CollisionPair &pair =
+          pairs[first + (lane < numValid ? lane : numValid - 1)];
+      const Body &bodyA = bodies[pair.a];
+      const Body &bodyB = bodies[pair.b];
+      const Vec3 posA = bodyA.transform.GetPosition();
+      const Vec3 posB = bodyB.transform.GetPosition();
+      lanes[0][lane] = posA.x;
+      lanes[1][lane] = posA.y;
+      lanes[2][lane] = posA.z;
+      lanes[3][lane] = posB.x;
+      lanes[4][lane] = posB.y;
+      lanes[5][lane] = posB.z;
+      lanes[6][lane] = bodyA.linearVelocity.x;
+      lanes[7][lane] = bodyA.linearVelocity.y;
+      lanes[8][lane] = bodyA.linearVelocity.z;
+      lanes[9][lane] = bodyB.linearVelocity.x;
+      lanes[10][lane] = bodyB.linearVelocity.y;
+      lanes[11][lane] = bodyB.linearVelocity.z;
+      lanes[12][lane] = bodyA.transform.GetScale().x;
+      lanes[13][lane] = bodyB.transform.GetScale().x;
+    }
+
+    // Same steps as SphereSphereDynamic, with both of its branches evaluated
+    // and the short ray one selected per lane
+    const Lanes zero = Set(0.f);
+    const Lanes dtLanes = Set(dt);
+    const Lanes posAX = Load(lanes[0]);
+    const Lanes posAY = Load(lanes[1]);
+    const Lanes posAZ = Load(lanes[2]);
+    const Lanes radius = Add(Load(lanes[12]), Load(lanes[13]));
+    const Lanes dirX = Sub(
+        Add(posAX, Mul(Sub(Load(lanes[6]), Load(lanes[9])), dtLanes)), posAX);
+    const Lanes dirY = Sub(
+        Add(posAY, Mul(Sub(Load(lanes[7]), Load(lanes[10])), dtLanes)), posAY);
+    const Lanes dirZ = Sub(
+        Add(posAZ, Mul(Sub(Load(lanes[8]), Load(lanes[11])), dtLanes)), posAZ);
+    const Lanes mX = Sub(Load(lanes[3]), posAX);
+    const Lanes mY = Sub(Load(lanes[4]), posAY);
+    const Lanes mZ = Sub(Load(lanes[5]), posAZ);
+    const Lanes a = Add(Add(Mul(dirX, dirX), Mul(dirY, dirY)), Mul(dirZ, dirZ));
+    const Lanes b = Add(Add(Mul(mX, dirX), Mul(mY, dirY)), Mul(mZ, dirZ));
+    const Lanes distance2 = Add(Add(Mul(mX, mX), Mul(mY, mY)), Mul(mZ, mZ));
+    const Lanes c = Sub(distance2, Mul(radius, radius));
+
+    // Ray against the sphere inflated by both radii
+    const Lanes delta = Sub(Mul(b, b), Mul(a, c));
+    const Lanes invA = Div(Set(1.f), a);
+    const Lanes deltaRoot = Sqrt(delta);
+    Lanes t0 = Mul(invA, Sub(b, deltaRoot));
+    Lanes t1 = Mul(invA, Add(b, deltaRoot));
+    Lanes hit = LessEqual(zero, delta);
+
+    // Too short a ray, only checks if the spheres already touch
+    const Lanes shortRay = Less(a, Set(0.001f * 0.001f));
+    const Lanes touchRadius = Add(radius, Set(0.001f));
+    hit = Select(hit, LessEqual(distance2, Mul(touchRadius, touchRadius)),
+                 shortRay);
+    t0 = Select(t0, zero, shortRay);
+    t1 = Select(t1, zero, shortRay);
+
+    t0 = Mul(t0, dtLanes);
+    t1 = Mul(t1, dtLanes);
+    hit = And(hit, LessEqual(zero, t1));
+    const Lanes toi = Select(t0, zero, Less(t0, zero));
+    hit = And(hit, LessEqual(toi, dtLanes));
+
+    Store(toiLanes, toi);
+    Store(separationLanes, Sub(Sqrt(distance2), radius));
+    for (i32 lane = 0; lane < numValid; lane++) {
+      results.separations[first + lane] = separationLanes[lane];
+    }
+    // Compact the hits
+    u32 mask = GetMask(hit) & ((1u << numValid) - 1);
+    for (u32 lane = 0; mask != 0; lane++, mask >>= 1) {
+      if (mask & 1) {
+        results.hits[numHits] = first + (i32)lane;
+        results.toi[numHits] = toiLanes[lane];
+        numHits++;
+      }
+    }
+  }
+  results.hits.resize(numHits);
+  results.toi.resize(numHits);
 }
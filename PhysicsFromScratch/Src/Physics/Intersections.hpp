@@ -1,9 +1,43 @@
 #pragma once
 
+#include "Broadphase.hpp"
 #include "Contact.hpp"
 
 bool RaySphere(const Vec3 &rayStart, const Vec3 &rayDir,
                const Vec3 &sphereCenter, const f32 sphereRadius, f32 &t1,
                f32 &t2);
 
-bool Intersect(Body *bodyA, Body *bodyB, f32 dt_Sec, Contact &contact);
+// Swept test of two spheres over dt. On a hit toi is the earliest time of
+// impact in [0, dt] and ptOnA/ptOnB are the touching points at that time
+bool SphereSphereDynamic(const f32 radiusA, const f32 radiusB, const Vec3 &posA,
+                         const Vec3 &posB, const Vec3 &velA, const Vec3 &velB,
+                         const f32 dt, Vec3 &ptOnA, Vec3 &ptOnB, f32 &toi);
+
+// Touching points of two spheres moved to the time of impact
+void SphereContactPoints(const f32 radiusA, const f32 radiusB,
+                         const Vec3 &posA, const Vec3 &posB, const Vec3 &velA,
+                         const Vec3 &velB, const f32 toi, Vec3 &ptOnA,
+                         Vec3 &ptOnB);
+
+// Output of SphereSphereDynamicBatch, kept between calls so the buffers are
+// reused
+struct SweptSphereResults {
+  std::vector<i32> hits;        // Index of every pair that hit, ascending
+  std::vector<f32> toi;         // Time of impact of every hit
+  std::vector<f32> separations; // Current gap of every pair, see GetSeparation
+};
+
+// SphereSphereDynamic over count pairs of sphere bodies, run on a register of
+// pairs at a time. Positions, velocities and radii are gathered into lanes, so
+// the test itself runs without branches, and only the hits are written out
+void SphereSphereDynamicBatch(const Body *bodies, const CollisionPair *pairs,
+                              const i32 count, const f32 dt,
+                              SweptSphereResults &results);
+
+// Fills in the local space points, normal and separation of a contact whose
+// bodies, world space points and time of impact are set. The bodies are left
+// untouched
+void FinishContact(Contact &contact);
+
+// Distance between the surfaces of two spheres, negative when they overlap
+f32 GetSeparation(const Body *bodyA, const Body *bodyB);
@@ -0,0 +1,277 @@
+#include "LinearBVH.hpp"
+#include "ParallelBuffers.hpp"
+#include "RadixSort.hpp"
+#include <Assert.hpp>
+#include <Profiler.hpp>
+#include <atomic>
+#include <bit>
+#include <omp.h>
+
+// Below this many bodies the worker threads cost more than they save
+static constexpr i32 kParallelMinLeaves = 1024;
+
+// Spreads the low 10 bits of value out so there are two zero bits between each
+static inline u32 ExpandBits(u32 value) {
+  value = (value * 0x00010001u) & 0xFF0000FFu;
+  value = (value * 0x00000101u) & 0x0F00F00Fu;
+  value = (value * 0x00000011u) & 0xC30C30C3u;
+  value = (value * 0x00000005u) & 0x49249249u;
+  return value;
+}
+
+// 30-bit Morton code of a point inside the unit cube
+static inline u32 GetMortonCode(const Vec3 &point) {
+  const Vec3 scaled = glm::clamp(point * 1024.f, Vec3(0.f), Vec3(1023.f));
+  const u32 x = ExpandBits((u32)scaled.x);
+  const u32 y = ExpandBits((u32)scaled.y);
+  const u32 z = ExpandBits((u32)scaled.z);
+  return (x << 2) | (y << 1) | z;
+}
+
+static inline Bounds Combine(const Bounds &a, const Bounds &b) {
+  Bounds bounds;
+  bounds.mins = glm::min(a.mins, b.mins);
+  bounds.maxs = glm::max(a.maxs, b.maxs);
+  return bounds;
+}
+
+void LinearBVH::Clear() {
+  m_Bounds.clear();
+  m_Keys.clear();
+  m_LeafIds.clear();
+  m_LeafBounds.clear();
+  m_LeafParents.clear();
+  m_Nodes.clear();
+  m_Pairs.clear();
+}
+
+void LinearBVH::Update(const Body *bodies, const i32 num, const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  ComputeMortonCodes(bodies, num, dt_sec);
+  BuildHierarchy();
+  Refit();
+  FindPairs();
+  HELIX_PROFILER_PLOT("Broadphase Candidate Pairs", (i64)m_Pairs.size());
+}
+
+void LinearBVH::ComputeMortonCodes(const Body *bodies, const i32 num,
+                                   const f32 dt_sec) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  // Static bodies are paired by the StaticBroadPhase
+  m_Keys.clear();
+  for (i32 i = 0; i < num; i++) {
+    if (!IsStaticBody(&bodies[i])) {
+      MortonKey key;
+      key.code = 0;
+      key.id = i;
+      m_Keys.push_back(key);
+    }
+  }
+  const i32 numLeaves = (i32)m_Keys.size();
+
+  m_Bounds.resize(num);
+#pragma omp parallel for if (numLeaves >= kParallelMinLeaves)
+  for (i32 i = 0; i < numLeaves; i++) {
+    const i32 id = m_Keys[i].id;
+    m_Bounds[id] = GetBroadPhaseBounds(&bodies[id], dt_sec);
+  }
+
+  // Quantize the centers relative to the box around all of them
+  Bounds centerBounds;
+  for (i32 i = 0; i < numLeaves; i++) {
+    const Bounds &bounds = m_Bounds[m_Keys[i].id];
+    centerBounds.Expand((bounds.mins + bounds.maxs) * 0.5f);
+  }
+  const Vec3 extent = centerBounds.maxs - centerBounds.mins;
+  const Vec3 invExtent(extent.x > 0.f ? 1.f / extent.x : 0.f,
+                       extent.y > 0.f ? 1.f / extent.y : 0.f,
+                       extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+#pragma omp parallel for if (numLeaves >= kParallelMinLeaves)
+  for (i32 i = 0; i < numLeaves; i++) {
+    const Bounds &bounds = m_Bounds[m_Keys[i].id];
+    const Vec3 center = (bounds.mins + bounds.maxs) * 0.5f;
+    m_Keys[i].code = GetMortonCode((center - centerBounds.mins) * invExtent);
+  }
+
+  // The sort is stable, so bodies sharing a code stay in id order and the
+  // tree is the same every run
+  m_Scratch.resize(numLeaves);
+  RadixSort(m_Keys.data(), m_Scratch.data(), numLeaves,
+            [](const MortonKey &key) { return key.code; });
+
+  m_LeafIds.resize(numLeaves);
+  m_LeafBounds.resize(numLeaves);
+  m_LeafParents.resize(numLeaves);
+#pragma omp parallel for if (numLeaves >= kParallelMinLeaves)
+  for (i32 i = 0; i < numLeaves; i++) {
+    m_LeafIds[i] = m_Keys[i].id;
+    m_LeafBounds[i] = m_Bounds[m_Keys[i].id];
+    m_LeafParents[i] = -1;
+  }
+}
+
+// Length of the common prefix of the keys of leaves i and j, or -1 when j is
+// out of range. Equal codes fall back to comparing the leaf indices so every
+// key is unique
+i32 LinearBVH::CommonPrefix(const i32 i, const i32 j) const {
+  if (j < 0 || j >= (i32)m_Keys.size()) {
+    return -1;
+  }
+  const u32 codeI = m_Keys[i].code;
+  const u32 codeJ = m_Keys[j].code;
+  if (codeI == codeJ) {
+    return 32 + std::countl_zero((u32)(i ^ j));
+  }
+  return std::countl_zero(codeI ^ codeJ);
+}
+
+// Range of leaves covered by an internal node. Node i always starts or ends at
+// leaf i, the direction is towards the neighbour sharing the longer prefix
+void LinearBVH::DetermineRange(const i32 node, i32 &first, i32 &last) const {
+  const i32 direction =
+      CommonPrefix(node, node + 1) - CommonPrefix(node, node - 1) >= 0 ? 1 : -1;
+  const i32 minPrefix = CommonPrefix(node, node - direction);
+
+  // Find an upper bound on the range length, then binary search the end
+  i32 maxLength = 2;
+  while (CommonPrefix(node, node + maxLength * direction) > minPrefix) {
+    maxLength <<= 1;
+  }
+  i32 length = 0;
+  for (i32 step = maxLength >> 1; step >= 1; step >>= 1) {
+    if (CommonPrefix(node, node + (length + step) * direction) > minPrefix) {
+      length += step;
+    }
+  }
+
+  const i32 other = node + length * direction;
+  first = glm::min(node, other);
+  last = glm::max(node, other);
+}
+
+// Last leaf of the left child, where the highest differing bit of the range
+// flips
+i32 LinearBVH::FindSplit(const i32 first, const i32 last) const {
+  const i32 rangePrefix = CommonPrefix(first, last);
+  i32 split = first;
+  i32 step = last - first;
+  do {
+    step = (step + 1) >> 1;
+    const i32 newSplit = split + step;
+    if (newSplit < last && CommonPrefix(first, newSplit) > rangePrefix) {
+      split = newSplit;
+    }
+  } while (step > 1);
+  return split;
+}
+
+void LinearBVH::BuildHierarchy() {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  const i32 numLeaves = (i32)m_Keys.size();
+  const i32 numNodes = glm::max(numLeaves - 1, 0);
+  m_Nodes.resize(numNodes);
+  if (numNodes == 0) {
+    return;
+  }
+  m_Nodes[0].parent = -1;
+
+  // Every internal node finds its range and split on its own, and every child
+  // has exactly one parent writing to it, so there is nothing to synchronize
+#pragma omp parallel for if (numLeaves >= kParallelMinLeaves)
+  for (i32 i = 0; i < numNodes; i++) {
+    i32 first, last;
+    DetermineRange(i, first, last);
+    const i32 split = FindSplit(first, last);
+
+    LBVHNode &node = m_Nodes[i];
+    node.lastLeaf = last;
+    if (split == first) {
+      node.left = ~split;
+      m_LeafParents[split] = i;
+    } else {
+      node.left = split;
+      m_Nodes[split].parent = i;
+    }
+    if (split + 1 == last) {
+      node.right = ~(split + 1);
+      m_LeafParents[split + 1] = i;
+    } else {
+      node.right = split + 1;
+      m_Nodes[split + 1].parent = i;
+    }
+  }
+}
+
+void LinearBVH::Refit() {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  const i32 numLeaves = (i32)m_LeafIds.size();
+  m_VisitCounts.assign(m_Nodes.size(), 0);
+
+  // Walk up from every leaf. The first path to reach a node stops there, the
+  // second one knows both children are done and carries on with the union
+#pragma omp parallel for if (numLeaves >= kParallelMinLeaves)
+  for (i32 leaf = 0; leaf < numLeaves; leaf++) {
+    i32 index = m_LeafParents[leaf];
+    while (index != -1) {
+      if (std::atomic_ref<i32>(m_VisitCounts[index]).fetch_add(1) == 0) {
+        break;
+      }
+      LBVHNode &node = m_Nodes[index];
+      const Bounds &left = LBVH_IS_LEAF(node.left)
+                               ? m_LeafBounds[LBVH_LEAF_INDEX(node.left)]
+                               : m_Nodes[node.left].bounds;
+      const Bounds &right = LBVH_IS_LEAF(node.right)
+                                ? m_LeafBounds[LBVH_LEAF_INDEX(node.right)]
+                                : m_Nodes[node.right].bounds;
+      node.bounds = Combine(left, right);
+      index = node.parent;
+    }
+  }
+}
+
+void LinearBVH::FindPairs() {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  const i32 numLeaves = (i32)m_LeafIds.size();
+  const i32 numChunks =
+      numLeaves >= kParallelMinLeaves ? omp_get_max_threads() * 4 : 1;
+  const i32 chunkSize = (numLeaves + numChunks - 1) / numChunks;
+  m_ChunkPairs.resize(numChunks);
+
+  // Each leaf only looks for leaves after it in Morton order, skipping whole
+  // subtrees that end before it, so every pair is found once
+#pragma omp parallel for schedule(dynamic, 1) if (numChunks > 1)
+  for (i32 chunk = 0; chunk < numChunks; chunk++) {
+    std::vector<CollisionPair> &pairs = m_ChunkPairs[chunk];
+    pairs.clear();
+    const i32 end = glm::min((chunk + 1) * chunkSize, numLeaves);
+    for (i32 leaf = chunk * chunkSize; leaf < end && numLeaves > 1; leaf++) {
+      const Bounds &bounds = m_LeafBounds[leaf];
+      CollisionPair pair;
+      pair.a = m_LeafIds[leaf];
+
+      i32 stack[128];
+      i32 stackCount = 0;
+      stack[stackCount++] = 0;
+      while (stackCount > 0) {
+        const LBVHNode &node = m_Nodes[stack[--stackCount]];
+        const i32 children[2] = {node.left, node.right};
+        for (const i32 child : children) {
+          if (LBVH_IS_LEAF(child)) {
+            const i32 other = LBVH_LEAF_INDEX(child);
+            if (other > leaf && bounds.DoesIntersect(m_LeafBounds[other])) {
+              pair.b = m_LeafIds[other];
+              pairs.push_back(pair);
+            }
+          } else if (m_Nodes[child].lastLeaf > leaf &&
+                     bounds.DoesIntersect(m_Nodes[child].bounds)) {
+            HASSERT(stackCount < 128);
+            stack[stackCount++] = child;
+          }
+        }
+      }
+    }
+  }
+
+  ConcatenateBuffers(m_ChunkPairs, m_Pairs);
+}
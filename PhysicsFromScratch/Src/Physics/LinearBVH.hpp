@@ -0,0 +1,76 @@
+#pragma once
+#include "Broadphase.hpp"
+#include <vector>
+
+// Child references of a LinearBVH node. Internal nodes are stored as their
+// index, leaves as the bitwise complement of their sorted leaf index
+#define LBVH_IS_LEAF(child) ((child) < 0)
+#define LBVH_LEAF_INDEX(child) (~(child))
+
+struct LBVHNode {
+  Bounds bounds;
+  i32 left;
+  i32 right;
+  i32 parent;
+  i32 lastLeaf; // Highest sorted leaf index under this node
+};
+
+/*
+====================================================
+LinearBVH
+
+Bounding volume hierarchy rebuilt from scratch every frame, for scenes where
+everything moves and incremental trees spend their time refitting. Body
+centers are quantized onto a 30-bit Morton curve and radix sorted, after which
+every internal node can find its own key range and split independently
+(Karras 2012), so the build is a parallel O(n) pass. Bounds are refit bottom up
+with one atomic counter per node and pairs come from one traversal per leaf,
+run in parallel and merged in leaf order so the output is deterministic.
+Static bodies are left to the StaticBroadPhase.
+====================================================
+*/
+class LinearBVH : public BroadPhaseInterface {
+public:
+  void Update(const Body *bodies, const i32 num, const f32 dt_sec) override;
+  void Clear() override;
+
+  const std::vector<CollisionPair> &GetPairs() const override {
+    return m_Pairs;
+  }
+  i32 GetLeafCount() const { return (i32)m_LeafIds.size(); }
+  // Root child reference, a leaf when there is a single body
+  i32 GetRoot() const { return m_LeafIds.size() > 1 ? 0 : ~0; }
+  const std::vector<LBVHNode> &GetNodes() const { return m_Nodes; }
+
+private:
+  void ComputeMortonCodes(const Body *bodies, const i32 num,
+                          const f32 dt_sec);
+  void BuildHierarchy();
+  void Refit();
+  void FindPairs();
+
+  void DetermineRange(const i32 node, i32 &first, i32 &last) const;
+  i32 FindSplit(const i32 first, const i32 last) const;
+  i32 CommonPrefix(const i32 i, const i32 j) const;
+
+private:
+  struct MortonKey {
+    u32 code;
+    i32 id;
+  };
+
+  std::vector<Bounds> m_Bounds; // Swept bounds per body
+  std::vector<MortonKey> m_Keys;
+  std::vector<MortonKey> m_Scratch;
+
+  // Leaves in Morton order
+  std::vector<i32> m_LeafIds;
+  std::vector<Bounds> m_LeafBounds;
+  std::vector<i32> m_LeafParents;
+
+  std::vector<LBVHNode> m_Nodes; // Internal nodes, the root is node 0
+  std::vector<i32> m_VisitCounts;
+
+  std::vector<std::vector<CollisionPair>> m_ChunkPairs;
+  std::vector<CollisionPair> m_Pairs;
+};
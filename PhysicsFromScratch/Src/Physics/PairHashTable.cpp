@@ -0,0 +1,91 @@
+#include "PairHashTable.hpp"
+#include <algorithm>
+
+u32 PairHashTable::GetSlot(const u64 key) const {
+  // Fibonacci hashing mixes both ids into the high bits
+  const u64 hash = key * 0x9E3779B97F4A7C15ull;
+  return (u32)(hash >> 32) & m_Mask;
+}
+
+i32 PairHashTable::Find(const u64 key) const {
+  if (m_Count == 0) {
+    return -1;
+  }
+  for (u32 slot = GetSlot(key);; slot = (slot + 1) & m_Mask) {
+    if (m_Keys[slot] == key) {
+      return m_Values[slot];
+    }
+    if (m_Keys[slot] == kEmptyKey) {
+      return -1;
+    }
+  }
+}
+
+void PairHashTable::Set(const u64 key, const i32 value) {
+  if ((u32)(m_Count + 1) * 2 > (u32)m_Keys.size()) {
+    Grow();
+  }
+  u32 slot = GetSlot(key);
+  while (m_Keys[slot] != kEmptyKey && m_Keys[slot] != key) {
+    slot = (slot + 1) & m_Mask;
+  }
+  if (m_Keys[slot] == kEmptyKey) {
+    m_Keys[slot] = key;
+    m_Count++;
+  }
+  m_Values[slot] = value;
+}
+
+bool PairHashTable::Remove(const u64 key) {
+  if (m_Count == 0) {
+    return false;
+  }
+  u32 slot = GetSlot(key);
+  while (m_Keys[slot] != key) {
+    if (m_Keys[slot] == kEmptyKey) {
+      return false;
+    }
+    slot = (slot + 1) & m_Mask;
+  }
+
+  // Shift later entries of the probe run back into the hole, unless their
+  // home slot lies cyclically after the hole
+  u32 hole = slot;
+  for (u32 next = (hole + 1) & m_Mask; m_Keys[next] != kEmptyKey;
+       next = (next + 1) & m_Mask) {
+    const u32 home = GetSlot(m_Keys[next]);
+    const u32 distanceToHome = (next - home) & m_Mask;
+    const u32 distanceToHole = (next - hole) & m_Mask;
+    if (distanceToHome >= distanceToHole) {
+      m_Keys[hole] = m_Keys[next];
+      m_Values[hole] = m_Values[next];
+      hole = next;
+    }
+  }
+  m_Keys[hole] = kEmptyKey;
+  m_Count--;
+  return true;
+}
+
+void PairHashTable::Clear() {
+  std::fill(m_Keys.begin(), m_Keys.end(), kEmptyKey);
+  m_Count = 0;
+}
+
+void PairHashTable::Grow() {
+  std::vector<u64> oldKeys;
+  std::vector<i32> oldValues;
+  oldKeys.swap(m_Keys);
+  oldValues.swap(m_Values);
+
+  const u32 capacity = oldKeys.empty() ? 64 : (u32)oldKeys.size() * 2;
+  m_Keys.assign(capacity, kEmptyKey);
+  m_Values.resize(capacity);
+  m_Mask = capacity - 1;
+  m_Count = 0;
+  for (size_t slot = 0; slot < oldKeys.size(); slot++) {
+    if (oldKeys[slot] != kEmptyKey) {
+      Set(oldKeys[slot], oldValues[slot]);
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <Defines.hpp>
+#include <vector>
+
+// Packs a body pair into one key, the lower id in the high bits so the key
+// does not depend on the order of a and b
+inline u64 GetPairKey(const i32 a, const i32 b) {
+  const u32 lo = (u32)(a < b ? a : b);
+  const u32 hi = (u32)(a < b ? b : a);
+  return ((u64)lo << 32) | (u64)hi;
+}
+
+/*
+====================================================
+PairHashTable
+
+Open addressing hash table from pair keys to i32 values. Keys and values live
+in two flat arrays probed linearly, the table doubles when it is half full and
+removal shifts the following entries back instead of leaving tombstones, so
+lookups never slow down as pairs come and go.
+====================================================
+*/
+class PairHashTable {
+public:
+  // Returns the value stored for key or -1
+  i32 Find(const u64 key) const;
+  // Inserts or overwrites the value for key
+  void Set(const u64 key, const i32 value);
+  // Returns false if the key was not in the table
+  bool Remove(const u64 key);
+  void Clear();
+
+  i32 GetCount() const { return m_Count; }
+
+  // callback(u64 key, i32 value) for every entry, in table order
+  template <typename T> void ForEach(T &&callback) const;
+
+private:
+  u32 GetSlot(const u64 key) const;
+  void Grow();
+
+private:
+  static constexpr u64 kEmptyKey = ~0ull;
+
+  std::vector<u64> m_Keys;
+  std::vector<i32> m_Values;
+  u32 m_Mask{0};
+  i32 m_Count{0};
+};
+
+template <typename T> void PairHashTable::ForEach(T &&callback) const {
+  for (size_t slot = 0; slot < m_Keys.size(); slot++) {
+    if (m_Keys[slot] != kEmptyKey) {
+      callback(m_Keys[slot], m_Values[slot]);
+    }
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <Defines.hpp>
+#include <cstring>
+#include <vector>
+
+// Concatenates per-chunk output buffers into out, in chunk order, and returns
+// how many elements were written. out has to have room for all of them.
+// Parallel passes write each chunk of their input range into its own buffer,
+// so merging them in order gives the same result as the serial loop no matter
+// how the chunks were scheduled. T has to be trivially copyable
+template <typename T>
+size_t ConcatenateBuffers(const std::vector<std::vector<T>> &buffers, T *out) {
+  const i32 numBuffers = (i32)buffers.size();
+  std::vector<size_t> offsets(numBuffers);
+  size_t total = 0;
+  for (i32 i = 0; i < numBuffers; i++) {
+    offsets[i] = total;
+    total += buffers[i].size();
+  }
+
+#pragma omp parallel for if (total >= 4096)
+  for (i32 i = 0; i < numBuffers; i++) {
+    if (!buffers[i].empty()) {
+      memcpy(out + offsets[i], buffers[i].data(),
+             sizeof(T) * buffers[i].size());
+    }
+  }
+  return total;
+}
+
+// Same as above, resizing out to fit
+template <typename T>
+void ConcatenateBuffers(const std::vector<std::vector<T>> &buffers,
+                        std::vector<T> &out) {
+  size_t total = 0;
+  for (const std::vector<T> &buffer : buffers) {
+    total += buffer.size();
+  }
+  out.resize(total);
+  ConcatenateBuffers(buffers, out.data());
+}
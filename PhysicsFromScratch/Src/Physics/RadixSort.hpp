@@ -0,0 +1,78 @@
+#pragma once
+#include <Defines.hpp>
+#include <cstring>
+
+// Maps a float onto a u32 whose unsigned ordering matches the float ordering.
+// Positive floats get their sign bit set, negative floats are fully inverted so
+// that larger magnitudes sort first.
+inline u32 FloatToSortableKey(const f32 value) {
+  u32 bits;
+  memcpy(&bits, &value, sizeof(u32));
+  const u32 mask = (bits & 0x80000000u) ? 0xffffffffu : 0x80000000u;
+  return bits ^ mask;
+}
+
+/*
+====================================================
+RadixSort
+
+Stable LSD radix sort over 32-bit keys, three passes of 11 bits.
+keyFn(const T &) returns the u32 key of an element. scratch must hold at least
+count elements and is only used as a ping-pong buffer; the sorted result always
+ends up in data. Passes where every key shares the same digit are skipped.
+====================================================
+*/
+template <typename T, typename KeyFn>
+void RadixSort(T *data, T *scratch, const u32 count, KeyFn keyFn) {
+  constexpr u32 kRadixBits = 11;
+  constexpr u32 kBucketCount = 1 << kRadixBits;
+  constexpr u32 kRadixMask = kBucketCount - 1;
+  constexpr u32 kPassCount = 3;
+
+  if (count < 2) {
+    return;
+  }
+
+  u32 histograms[kPassCount][kBucketCount];
+  memset(histograms, 0, sizeof(histograms));
+
+  for (u32 i = 0; i < count; i++) {
+    const u32 key = keyFn(data[i]);
+    histograms[0][key & kRadixMask]++;
+    histograms[1][(key >> kRadixBits) & kRadixMask]++;
+    histograms[2][(key >> (kRadixBits * 2)) & kRadixMask]++;
+  }
+
+  T *src = data;
+  T *dst = scratch;
+  for (u32 pass = 0; pass < kPassCount; pass++) {
+    u32 *histogram = histograms[pass];
+    const u32 shift = pass * kRadixBits;
+
+    // All keys share this digit, the pass would not move anything
+    if (histogram[(keyFn(src[0]) >> shift) & kRadixMask] == count) {
+      continue;
+    }
+
+    // Turn the counts into starting offsets
+    u32 offset = 0;
+    for (u32 bucket = 0; bucket < kBucketCount; bucket++) {
+      const u32 bucketCount = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += bucketCount;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+      const u32 digit = (keyFn(src[i]) >> shift) & kRadixMask;
+      dst[histogram[digit]++] = src[i];
+    }
+
+    T *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != data) {
+    memcpy(data, src, sizeof(T) * count);
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <Defines.hpp>
+#include <immintrin.h>
+
+// Thin wrappers over one register of floats, 8 lanes with AVX2 and 4 with SSE,
+// so batched kernels are written once for both. Loads and stores are aligned.
+// Comparisons return all bits set in the lanes where they hold
+#if defined(__AVX2__)
+static constexpr i32 kNumLanes = 8;
+using Lanes = __m256;
+static inline Lanes Set(const f32 value) { return _mm256_set1_ps(value); }
+static inline Lanes Load(const f32 *values) { return _mm256_load_ps(values); }
+static inline void Store(f32 *values, const Lanes a) {
+  _mm256_store_ps(values, a);
+}
+static inline Lanes Add(const Lanes a, const Lanes b) {
+  return _mm256_add_ps(a, b);
+}
+static inline Lanes Sub(const Lanes a, const Lanes b) {
+  return _mm256_sub_ps(a, b);
+}
+static inline Lanes Mul(const Lanes a, const Lanes b) {
+  return _mm256_mul_ps(a, b);
+}
+static inline Lanes Div(const Lanes a, const Lanes b) {
+  return _mm256_div_ps(a, b);
+}
+static inline Lanes Min(const Lanes a, const Lanes b) {
+  return _mm256_min_ps(a, b);
+}
+static inline Lanes Max(const Lanes a, const Lanes b) {
+  return _mm256_max_ps(a, b);
+}
+static inline Lanes Sqrt(const Lanes a) { return _mm256_sqrt_ps(a); }
+static inline Lanes Less(const Lanes a, const Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+}
+static inline Lanes LessEqual(const Lanes a, const Lanes b) {
+  return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+}
+static inline Lanes And(const Lanes a, const Lanes b) {
+  return _mm256_and_ps(a, b);
+}
+static inline Lanes Select(const Lanes a, const Lanes b, const Lanes mask) {
+  return _mm256_blendv_ps(a, b, mask);
+}
+static inline u32 GetMask(const Lanes a) { return (u32)_mm256_movemask_ps(a); }
+#else
+static constexpr i32 kNumLanes = 4;
+using Lanes = __m128;
+static inline Lanes Set(const f32 value) { return _mm_set1_ps(value); }
+static inline Lanes Load(const f32 *values) { return _mm_load_ps(values); }
+static inline void Store(f32 *values, const Lanes a) {
+  _mm_store_ps(values, a);
+}
+static inline Lanes Add(const Lanes a, const Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes Sub(const Lanes a, const Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes Mul(const Lanes a, const Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes Div(const Lanes a, const Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes Min(const Lanes a, const Lanes b) { return _mm_min_ps(a, b); }
+static inline Lanes Max(const Lanes a, const Lanes b) { return _mm_max_ps(a, b); }
+static inline Lanes Sqrt(const Lanes a) { return _mm_sqrt_ps(a); }
+static inline Lanes Less(const Lanes a, const Lanes b) {
+  return _mm_cmplt_ps(a, b);
+}
+static inline Lanes LessEqual(const Lanes a, const Lanes b) {
+  return _mm_cmple_ps(a, b);
+}
+static inline Lanes And(const Lanes a, const Lanes b) { return _mm_and_ps(a, b); }
+// SSE2 has no blend, pick b where mask is set and a elsewhere
+static inline Lanes Select(const Lanes a, const Lanes b, const Lanes mask) {
+  return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+static inline u32 GetMask(const Lanes a) { return (u32)_mm_movemask_ps(a); }
+#endif // __AVX2__
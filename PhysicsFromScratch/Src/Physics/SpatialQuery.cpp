@@ -0,0 +1,214 @@
+#include "SpatialQuery.hpp"
+#include "Intersections.hpp"
+#include "SimdLanes.hpp"
+#include <Profiler.hpp>
+#include <algorithm>
+#include <omp.h>
+
+// Below this many rays the worker threads cost more than they save
+static constexpr i32 kParallelMinRays = 1024;
+// Packets handed to a thread at a time
+static constexpr i32 kPacketsPerTask = 16;
+
+// One register of rays
+static constexpr i32 kPacketSize = kNumLanes;
+
+void SpatialQuery::Clear() {
+  m_Tree.Clear();
+  m_Proxies.clear();
+  m_Bodies = nullptr;
+}
+
+void SpatialQuery::Update(const Body *bodies, const i32 num) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  m_Bodies = bodies;
+  while ((i32)m_Proxies.size() > num) {
+    m_Tree.DestroyProxy(m_Proxies.back());
+    m_Proxies.pop_back();
+  }
+
+  for (i32 i = 0; i < num; i++) {
+    const Bounds bounds = GetSphereBounds(&bodies[i],
+                                          bodies[i].transform.GetPosition(),
+                                          bodies[i].transform.GetRotation());
+    if (i < (i32)m_Proxies.size()) {
+      m_Tree.MoveProxy(m_Proxies[i], bounds, kFatMargin);
+    } else {
+      m_Proxies.push_back(m_Tree.CreateProxy(bounds, i, kFatMargin));
+    }
+  }
+}
+
+bool SpatialQuery::RayCastBody(const i32 bodyId, const Vec3 &rayStart,
+                               const Vec3 &rayDir, const f32 maxT,
+                               RayHit &hit) const {
+  const Body &body = m_Bodies[bodyId];
+  const Vec3 &center = body.transform.GetPosition();
+  const f32 radius = body.transform.GetScale().x;
+  f32 t1, t2;
+  if (!RaySphere(rayStart, rayDir, center, radius, t1, t2) || t1 < 0.f ||
+      t1 > maxT) {
+    return false;
+  }
+
+  hit.bodyId = bodyId;
+  hit.t = t1;
+  hit.point = rayStart + rayDir * t1;
+  hit.normal = (hit.point - center) / radius;
+  return true;
+}
+
+bool SpatialQuery::RayCastClosest(const Vec3 &rayStart, const Vec3 &rayDir,
+                                  const f32 maxT, RayHit &hit) const {
+  bool found = false;
+  // Every hit clips the ray, so only bodies closer than the best one so far
+  // are visited
+  m_Tree.RayCast(rayStart, rayDir, maxT,
+                 [&](const i32 bodyId, const f32 currentMaxT) {
+                   RayHit candidate;
+                   if (RayCastBody(bodyId, rayStart, rayDir, currentMaxT,
+                                   candidate) &&
+                       (!found || candidate.t < hit.t)) {
+                     hit = candidate;
+                     found = true;
+                     return candidate.t;
+                   }
+                   return currentMaxT;
+                 });
+  return found;
+}
+
+void SpatialQuery::RayCastAll(const Vec3 &rayStart, const Vec3 &rayDir,
+                              const f32 maxT,
+                              std::vector<RayHit> &hits) const {
+  hits.clear();
+  RayCastAll(rayStart, rayDir, maxT, [&hits](const RayHit &hit) {
+    hits.push_back(hit);
+    return true;
+  });
+  std::sort(hits.begin(), hits.end(), [](const RayHit &a, const RayHit &b) {
+    return a.t < b.t || (a.t == b.t && a.bodyId < b.bodyId);
+  });
+}
+
+void SpatialQuery::RayCastBatch(const Vec3 *rayStarts, const Vec3 *rayDirs,
+                                const i32 num, const f32 maxT, f32 *outT,
+                                i32 *outBodyIds) const {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  // Every ray writes only its own outputs, so the packets need no
+  // synchronization and the results do not depend on the thread count
+  const i32 numPackets = (num + kPacketSize - 1) / kPacketSize;
+#pragma omp parallel for schedule(dynamic, kPacketsPerTask)                    \
+    if (num >= kParallelMinRays)
+  for (i32 packet = 0; packet < numPackets; packet++) {
+    const i32 first = packet * kPacketSize;
+    RayCastPacket(rayStarts + first, rayDirs + first,
+                  glm::min(kPacketSize, num - first), maxT, outT + first,
+                  outBodyIds + first);
+  }
+}
+
+void SpatialQuery::RayCastPacket(const Vec3 *rayStarts, const Vec3 *rayDirs,
+                                 const i32 count, const f32 maxT, f32 *outT,
+                                 i32 *outBodyIds) const {
+  // Transpose the rays into one register per component. Unused lanes get a
+  // negative maximum distance, which no box or sphere test can pass
+  alignas(32) f32 lanes[10][kPacketSize];
+  i32 hitIds[kPacketSize];
+  for (i32 lane = 0; lane < kPacketSize; lane++) {
+    const bool active = lane < count;
+    const Vec3 start = active ? rayStarts[lane] : Vec3(0.f);
+    const Vec3 dir = active ? rayDirs[lane] : Vec3(1.f);
+    lanes[0][lane] = start.x;
+    lanes[1][lane] = start.y;
+    lanes[2][lane] = start.z;
+    lanes[3][lane] = dir.x;
+    lanes[4][lane] = dir.y;
+    lanes[5][lane] = dir.z;
+    lanes[6][lane] = 1.f / dir.x;
+    lanes[7][lane] = 1.f / dir.y;
+    lanes[8][lane] = 1.f / dir.z;
+    lanes[9][lane] = 1.f / glm::dot(dir, dir);
+    hitIds[lane] = -1;
+  }
+  const Lanes startX = Load(lanes[0]);
+  const Lanes startY = Load(lanes[1]);
+  const Lanes startZ = Load(lanes[2]);
+  const Lanes dirX = Load(lanes[3]);
+  const Lanes dirY = Load(lanes[4]);
+  const Lanes dirZ = Load(lanes[5]);
+  const Lanes invDirX = Load(lanes[6]);
+  const Lanes invDirY = Load(lanes[7]);
+  const Lanes invDirZ = Load(lanes[8]);
+  const Lanes invDirLength2 = Load(lanes[9]);
+  for (i32 lane = 0; lane < kPacketSize; lane++) {
+    lanes[0][lane] = lane < count ? maxT : -1.f;
+  }
+  Lanes tMax = Load(lanes[0]);
+  const Lanes zero = Set(0.f);
+
+  const std::vector<TreeNode> &nodes = m_Tree.GetNodes();
+  i32 stack[256];
+  i32 stackCount = 0;
+  if (m_Tree.GetRoot() != AABB_NULL_NODE) {
+    stack[stackCount++] = m_Tree.GetRoot();
+  }
+  while (stackCount > 0) {
+    const TreeNode &node = nodes[stack[--stackCount]];
+
+    // Slab test of the node bounds against every lane, the packet goes on
+    // while at least one ray enters the box before its closest hit
+    const Lanes t0X = Mul(Sub(Set(node.bounds.mins.x), startX), invDirX);
+    const Lanes t1X = Mul(Sub(Set(node.bounds.maxs.x), startX), invDirX);
+    const Lanes t0Y = Mul(Sub(Set(node.bounds.mins.y), startY), invDirY);
+    const Lanes t1Y = Mul(Sub(Set(node.bounds.maxs.y), startY), invDirY);
+    const Lanes t0Z = Mul(Sub(Set(node.bounds.mins.z), startZ), invDirZ);
+    const Lanes t1Z = Mul(Sub(Set(node.bounds.maxs.z), startZ), invDirZ);
+    const Lanes tEnter = Max(Max(Min(t0X, t1X), Min(t0Y, t1Y)),
+                             Max(Min(t0Z, t1Z), zero));
+    const Lanes tExit =
+        Min(Min(Max(t0X, t1X), Max(t0Y, t1Y)), Min(Max(t0Z, t1Z), tMax));
+    if (GetMask(LessEqual(tEnter, tExit)) == 0) {
+      continue;
+    }
+
+    if (!node.IsLeaf()) {
+      stack[stackCount++] = node.child1;
+      stack[stackCount++] = node.child2;
+      continue;
+    }
+
+    // Same quadratic as RaySphere, keeping the nearer root
+    const Body &body = m_Bodies[node.userData];
+    const Vec3 &center = body.transform.GetPosition();
+    const f32 radius = body.transform.GetScale().x;
+    const Lanes mX = Sub(Set(center.x), startX);
+    const Lanes mY = Sub(Set(center.y), startY);
+    const Lanes mZ = Sub(Set(center.z), startZ);
+    const Lanes b = Add(Add(Mul(mX, dirX), Mul(mY, dirY)), Mul(mZ, dirZ));
+    const Lanes c = Sub(Add(Add(Mul(mX, mX), Mul(mY, mY)), Mul(mZ, mZ)),
+                        Set(radius * radius));
+    const Lanes a = Add(Add(Mul(dirX, dirX), Mul(dirY, dirY)), Mul(dirZ, dirZ));
+    const Lanes delta = Sub(Mul(b, b), Mul(a, c));
+    const Lanes t = Mul(Sub(b, Sqrt(Max(delta, zero))), invDirLength2);
+    const Lanes hit = And(And(LessEqual(zero, delta), LessEqual(zero, t)),
+                          LessEqual(t, tMax));
+
+    u32 mask = GetMask(hit);
+    if (mask == 0) {
+      continue;
+    }
+    tMax = Select(tMax, t, hit);
+    for (u32 lane = 0; mask != 0; lane++, mask >>= 1) {
+      if (mask & 1) {
+        hitIds[lane] = node.userData;
+      }
+    }
+  }
+
+  Store(lanes[0], tMax);
+  for (i32 lane = 0; lane < count; lane++) {
+    outT[lane] = lanes[0][lane];
+    outBodyIds[lane] = hitIds[lane];
+  }
+}
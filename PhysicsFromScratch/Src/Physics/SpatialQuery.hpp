@@ -0,0 +1,119 @@
+#pragma once
+#include "Body.hpp"
+#include "DynamicAABBTree.hpp"
+#include <vector>
+
+struct RayHit {
+  i32 bodyId;
+  f32 t; // Distance along the ray in units of rayDir
+  Vec3 point;
+  Vec3 normal;
+};
+
+/*
+====================================================
+SpatialQuery
+
+Ray and overlap queries against every body, static or dynamic, through a
+DynamicAABBTree of their sphere bounds. Update syncs the tree with the bodies
+and only re-inserts the ones that left their fat box, so it is cheap to call
+once per step and before queries on bodies that may have been edited. The body
+array passed to Update has to stay valid until the next Update.
+
+Visitors return false to stop the query early. Rays starting inside a sphere
+do not hit it.
+====================================================
+*/
+class SpatialQuery {
+public:
+  void Update(const Body *bodies, const i32 num);
+  void Clear();
+
+  // Closest hit within maxT
+  bool RayCastClosest(const Vec3 &rayStart, const Vec3 &rayDir, const f32 maxT,
+                      RayHit &hit) const;
+  // visitor(const RayHit &) -> bool for every hit within maxT, in no
+  // particular order
+  template <typename T>
+  void RayCastAll(const Vec3 &rayStart, const Vec3 &rayDir, const f32 maxT,
+                  T &&visitor) const;
+  // Every hit within maxT sorted from nearest to farthest
+  void RayCastAll(const Vec3 &rayStart, const Vec3 &rayDir, const f32 maxT,
+                  std::vector<RayHit> &hits) const;
+
+  // Closest hit for each of num rays, written to outT[i] and outBodyIds[i],
+  // or maxT and -1 on a miss. Neighbouring rays travel through the tree
+  // together in packets, so rays should be ordered so that neighbours point
+  // the same way, like the scanlines of a lidar sweep
+  void RayCastBatch(const Vec3 *rayStarts, const Vec3 *rayDirs, const i32 num,
+                    const f32 maxT, f32 *outT, i32 *outBodyIds) const;
+
+  // visitor(i32 bodyId) -> bool for every body touching the sphere
+  template <typename T>
+  void OverlapSphere(const Vec3 &center, const f32 radius, T &&visitor) const;
+  // visitor(i32 bodyId) -> bool for every body touching the box
+  template <typename T>
+  void QueryBounds(const Bounds &bounds, T &&visitor) const;
+
+  const DynamicAABBTree &GetTree() const { return m_Tree; }
+
+private:
+  void RayCastPacket(const Vec3 *rayStarts, const Vec3 *rayDirs,
+                     const i32 count, const f32 maxT, f32 *outT,
+                     i32 *outBodyIds) const;
+  bool RayCastBody(const i32 bodyId, const Vec3 &rayStart, const Vec3 &rayDir,
+                   const f32 maxT, RayHit &hit) const;
+
+private:
+  static constexpr f32 kFatMargin = 0.1f;
+
+  DynamicAABBTree m_Tree;
+  std::vector<i32> m_Proxies; // Proxy id per body
+  const Body *m_Bodies{nullptr};
+};
+
+template <typename T>
+void SpatialQuery::RayCastAll(const Vec3 &rayStart, const Vec3 &rayDir,
+                              const f32 maxT, T &&visitor) const {
+  m_Tree.RayCast(rayStart, rayDir, maxT,
+                 [&](const i32 bodyId, const f32 currentMaxT) {
+                   RayHit hit;
+                   if (RayCastBody(bodyId, rayStart, rayDir, currentMaxT,
+                                   hit) &&
+                       !visitor(hit)) {
+                     return 0.f;
+                   }
+                   return currentMaxT;
+                 });
+}
+
+template <typename T>
+void SpatialQuery::OverlapSphere(const Vec3 &center, const f32 radius,
+                                 T &&visitor) const {
+  Bounds bounds;
+  bounds.mins = center - Vec3(radius);
+  bounds.maxs = center + Vec3(radius);
+  m_Tree.Query(bounds, [&](const i32 bodyId) {
+    const Body &body = m_Bodies[bodyId];
+    const f32 reach = radius + body.transform.GetScale().x;
+    if (glm::length2(body.transform.GetPosition() - center) > reach * reach) {
+      return true;
+    }
+    return (bool)visitor(bodyId);
+  });
+}
+
+template <typename T>
+void SpatialQuery::QueryBounds(const Bounds &bounds, T &&visitor) const {
+  m_Tree.Query(bounds, [&](const i32 bodyId) {
+    // Distance from the sphere center to the closest point in the box
+    const Body &body = m_Bodies[bodyId];
+    const Vec3 &center = body.transform.GetPosition();
+    const Vec3 closest = glm::clamp(center, bounds.mins, bounds.maxs);
+    const f32 radius = body.transform.GetScale().x;
+    if (glm::length2(closest - center) > radius * radius) {
+      return true;
+    }
+    return (bool)visitor(bodyId);
+  });
+}
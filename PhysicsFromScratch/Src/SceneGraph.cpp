@@ -2,14 +2,21 @@
 #include "Physics/Broadphase.hpp"
 #include "Physics/Contact.hpp"
 #include "Physics/Intersections.hpp"
+#include "Physics/ParallelBuffers.hpp"
+#include "Physics/RadixSort.hpp"
 #include <Profiler.hpp>
 // Vendor
 #include <SDL3/SDL_events.h>
 #include <SDL3/SDL_keycode.h>
+#include <SDL3/SDL_timer.h>
 #include <imgui.h>
+#include <omp.h>
 #include <stb_image.h>
 
-#define MAX_BODIES 300
+// Spheres closer than this are treated as touching by the narrowphase
+static constexpr f32 kSeparationTolerance = 0.001f;
+// Below this many cached pairs the narrowphase runs on one thread
+static constexpr i32 kParallelNarrowPhaseMinPairs = 1024;
 
 struct RayDebugPushConstant {
   Mat4 viewProj;
@@ -38,21 +45,6 @@ Vec3 GetRayFromMouse(float mouseX, float mouseY, int screenWidth,
   return rayWorld;
 }
 
-bool RayIntersectsSphere(const glm::vec3 &rayOrigin, const glm::vec3 &rayDir,
-                         const glm::vec3 &sphereCenter, float sphereRadius,
-                         float &t) {
-  glm::vec3 L = sphereCenter - rayOrigin;
-  float tca = glm::dot(L, rayDir);
-  float d2 = glm::dot(L, L) - tca * tca;
-  float radius2 = sphereRadius * sphereRadius;
-
-  if (d2 > radius2)
-    return false;
-  float thc = sqrt(radius2 - d2);
-  t = tca - thc; // distance to intersection
-  return true;
-}
-
 SceneGraph::SceneGraph(hlx::VkContext &ctx, u32 maxEntityCount,
                        VkCommandPool vkTransferCommandPool,
                        VkCommandPool vkGraphicsCommandPool) {
@@ -326,10 +318,6 @@ SceneGraph::SceneGraph(hlx::VkContext &ctx, u32 maxEntityCount,
 
   ctx.CopyToBuffer(m_IndexBuffer.vkHandle, 0, indexBufferSize, indices.data(),
                    vkTransferCommandPool);
-
-  // Allocate temp contacts buffer
-  m_pTempContacts =
-      static_cast<Contact *>(malloc(sizeof(Contact) * MAX_BODIES * MAX_BODIES));
 }
 
 void SceneGraph::Shutdown(hlx::VkContext &ctx) {
@@ -355,7 +343,7 @@ void SceneGraph::Shutdown(hlx::VkContext &ctx) {
   ctx.DestroyBuffer(m_VertexBuffer);
   ctx.DestroyBuffer(m_IndexBuffer);
 
-  free(m_pTempContacts);
+  m_ContactPool.Release();
 }
 
 void SceneGraph::TogglePhysics() {
@@ -366,18 +354,49 @@ void SceneGraph::TogglePhysics() {
       bodies[i].linearVelocity = Vec3(0.f);
     }
   }
+  // Bodies can be edited while paused, so nothing cached about them holds
+  m_PairCache.Clear();
+  m_ContactManifolds.Clear();
+  m_PreviousPositions.clear();
+  MarkStaticBodiesDirty();
+}
+
+void SceneGraph::AdvanceBody(Body *body, const f32 time) {
+  f32 &bodyTime = m_BodyTimes[body - bodies.data()];
+  if (time > bodyTime) {
+    body->Update(time - bodyTime);
+    bodyTime = time;
+  }
 }
 
-i32 CompareContacts(const void *p1, const void *p2) {
-  Contact a = *(Contact *)p1;
-  Contact b = *(Contact *)p2;
-  if (a.timeOfImpact < b.timeOfImpact) {
-    return -1;
+void SceneGraph::SortContacts(const Contact *contacts, const i32 num) {
+  m_ContactOrder.resize(num);
+  if (num == 0) {
+    return;
   }
-  if (a.timeOfImpact == b.timeOfImpact) {
-    return 0;
+
+  // Contacts that already touch at the start of the step go first, in the
+  // order they were found, without taking part in the sort
+  i32 numTouching = 0;
+  for (i32 i = 0; i < num; i++) {
+    if (contacts[i].timeOfImpact == 0.f) {
+      m_ContactOrder[numTouching++] = {0, i};
+    }
   }
-  return 1;
+  i32 numSorted = numTouching;
+  for (i32 i = 0; i < num; i++) {
+    if (contacts[i].timeOfImpact != 0.f) {
+      m_ContactOrder[numSorted++] = {
+          FloatToSortableKey(contacts[i].timeOfImpact), i};
+    }
+  }
+
+  // The sort is stable, so contacts sharing a time of impact stay in the
+  // order they were found and the step is the same every run
+  const u32 numLater = (u32)(num - numTouching);
+  m_ContactOrderScratch.resize(numLater);
+  RadixSort(m_ContactOrder.data() + numTouching, m_ContactOrderScratch.data(),
+            numLater, [](const ContactSortKey &key) { return key.key; });
 }
 
 void SceneGraph::Update(const f32 dt_Sec) {
@@ -395,66 +414,257 @@ void SceneGraph::Update(const f32 dt_Sec) {
     HELIX_PROFILER_ZONE_END()
   }
 
+  BroadPhaseCounters counters{};
+  counters.numBodies = (i32)bodies.size();
+  for (const Body &body : bodies) {
+    counters.numStatic += IsStaticBody(&body) ? 1 : 0;
+  }
+  counters.skippedStaticPairs =
+      (u64)counters.numStatic * (u64)(counters.numStatic - 1) / 2;
+
+  m_ContactPool.Reset();
+  if (m_IterativeSolver) {
+    // Before the narrowphase, so it can skip the pairs still touching
+    m_ContactManifolds.Refresh(bodies.data());
+  }
+  if (m_FuseSphereCollision) {
+    // Every body is a sphere, so the sweep runs the narrowphase itself
+    m_SphereContactSweep.FindContacts(bodies.data(), (i32)bodies.size(),
+                                      dt_Sec, m_ContactPool);
+    counters.mode = BroadPhaseMode::SweepAndPrune;
+    counters.fused = true;
+    counters.sortedEndpoints = m_SphereContactSweep.GetSortedEndpoints();
+    counters.candidatePairs = m_SphereContactSweep.GetTestedPairs();
+    counters.staticPairs = m_SphereContactSweep.GetTestedStaticPairs();
+    counters.testedPairs = counters.candidatePairs + counters.staticPairs;
+  } else {
+    CollidePairs(dt_Sec, counters);
+  }
+  Contact *pContacts = m_ContactPool.GetContacts();
+  const int numContacts = m_ContactPool.GetCount();
+  // Pairs carried by a manifold are still touching, they just skipped the test
+  counters.contacts = (u32)numContacts + counters.carriedPairs;
+  m_Telemetry.Record(counters);
+
+  m_BodyTimes.assign(bodies.size(), 0.f);
+  if (m_IterativeSolver) {
+    // The solver only changes velocities, every body moves over the whole
+    // step below
+    m_ContactManifolds.AddContacts(bodies.data(), pContacts, numContacts);
+    m_ContactSolver.Solve(bodies.data(), (i32)bodies.size(),
+                          m_ContactManifolds, dt_Sec);
+  } else {
+    // Sort the times of impact from first to last
+    HELIX_PROFILER_ZONE("Sort TOI", HELIX_PROFILER_COLOR_BARRIER)
+    SortContacts(pContacts, numContacts);
+    HELIX_PROFILER_ZONE_END()
+
+    // Apply ballistic impulses. Every body keeps its own time within the step
+    // and only the two bodies of a contact are brought up to its time of
+    // impact, the rest move on in one go at the end
+    HELIX_PROFILER_ZONE("Apply Ballistic Impulses",
+                        HELIX_PROFILER_COLOR_BARRIER)
+    for (int i = 0; i < numContacts; i++) {
+      Contact &contact = pContacts[m_ContactOrder[i].index];
+      AdvanceBody(contact.bodyA, contact.timeOfImpact);
+      AdvanceBody(contact.bodyB, contact.timeOfImpact);
+      ResolveContact(contact);
+    }
+    HELIX_PROFILER_ZONE_END()
+  }
+
+  // Update the positions for the rest of this frame’s time
+  HELIX_PROFILER_ZONE("Update remaining positions",
+                      HELIX_PROFILER_COLOR_BARRIER)
+  for (int i = 0; i < bodies.size(); i++) {
+    AdvanceBody(&bodies[i], dt_Sec);
+  }
+  HELIX_PROFILER_ZONE_END()
+
+  SyncSpatialQuery();
+}
+
+void SceneGraph::CollidePairs(const f32 dt_Sec,
+                              BroadPhaseCounters &counters) {
   // BroadPhase
-  std::vector<CollisionPair> collisionPairs;
-  BroadPhase(bodies.data(), (int)bodies.size(), collisionPairs, dt_Sec);
+  m_BroadPhase.Update(bodies.data(), (int)bodies.size(), dt_Sec);
+  // Static bodies are kept out of the per-frame broadphase, the dynamic bodies
+  // are paired with them here so static-static pairs are never generated
+  m_StaticBroadPhase.Update(bodies.data(), (int)bodies.size(), dt_Sec);
+
+  // Keep the pairs across steps so the narrowphase can carry state per pair
+  m_PairCache.BeginStep();
+  m_PairCache.AddPairs(m_BroadPhase.GetPairs());
+  m_PairCache.AddPairs(m_StaticBroadPhase.GetPairs());
+  m_PairCache.EndStep();
+
+  // How far every body moved since the last step, used to age the separation
+  // bounds of the cached pairs
+  const size_t numKnownBodies = m_PreviousPositions.size();
+  m_PreviousPositions.resize(bodies.size());
+  m_BodyMotion.resize(bodies.size());
+  for (size_t i = 0; i < bodies.size(); i++) {
+    const Vec3 &position = bodies[i].transform.GetPosition();
+    m_BodyMotion[i] = i < numKnownBodies
+                          ? glm::length(position - m_PreviousPositions[i])
+                          : 0.f;
+    m_PreviousPositions[i] = position;
+  }
 
   //
   // NarrowPhase (perform actual collision detection)
   //
-  int numContacts = 0;
-  const int maxContacts = bodies.size() * bodies.size();
+  // Chunks of cached pairs are tested on worker threads, each into its own
+  // buffers. Every pair is tested on its own and the chunks are merged in pair
+  // order, so the contacts do not depend on the number of threads
+  const i32 numPairs = (i32)m_PairCache.GetPairs().size();
+  const i32 numChunks = numPairs >= kParallelNarrowPhaseMinPairs
+                            ? omp_get_max_threads() * 4
+                            : 1;
+  m_NarrowPhaseChunks.resize(numChunks);
+  m_NarrowPhaseContacts.resize(numChunks);
   HELIX_PROFILER_ZONE("NarrowPhase", HELIX_PROFILER_COLOR_BARRIER)
-  for (int i = 0; i < collisionPairs.size(); i++) {
-    const CollisionPair &pair = collisionPairs[i];
-    Body *bodyA = &bodies[pair.a];
-    Body *bodyB = &bodies[pair.b];
-    // Skip body pairs with infinite mass
-    if (0.0f == bodyA->invMass && 0.0f == bodyB->invMass) {
+#pragma omp parallel for schedule(dynamic, 1) if (numChunks > 1)
+  for (i32 chunk = 0; chunk < numChunks; chunk++) {
+    CollideChunk((i32)((i64)numPairs * chunk / numChunks),
+                 (i32)((i64)numPairs * (chunk + 1) / numChunks), dt_Sec,
+                 m_NarrowPhaseChunks[chunk], m_NarrowPhaseContacts[chunk]);
+  }
+  HELIX_PROFILER_ZONE_END()
+
+  i32 numTestedPairs = 0;
+  i32 numCarriedPairs = 0;
+  i32 numContacts = 0;
+  for (i32 chunk = 0; chunk < numChunks; chunk++) {
+    numTestedPairs += (i32)m_NarrowPhaseChunks[chunk].pairs.size();
+    numCarriedPairs += m_NarrowPhaseChunks[chunk].numCarried;
+    numContacts += (i32)m_NarrowPhaseContacts[chunk].size();
+  }
+  ConcatenateBuffers(m_NarrowPhaseContacts,
+                     m_ContactPool.Allocate(numContacts));
+
+  counters.mode = m_BroadPhase.GetActiveMode();
+  counters.sortedEndpoints = m_BroadPhase.GetSortedEndpoints();
+  counters.candidatePairs = (u32)m_BroadPhase.GetPairs().size();
+  counters.staticPairs = (u32)m_StaticBroadPhase.GetPairs().size();
+  counters.testedPairs = (u32)numTestedPairs;
+  counters.carriedPairs = (u32)numCarriedPairs;
+}
+
+void SceneGraph::CollideChunk(const i32 begin, const i32 end,
+                              const f32 dt_Sec, NarrowPhaseChunk &chunk,
+                              std::vector<Contact> &contacts) {
+  std::vector<CachedPair> &cachedPairs = m_PairCache.GetPairs();
+  chunk.pairs.clear();
+  chunk.cacheIndices.clear();
+  chunk.numCarried = 0;
+  contacts.clear();
+  for (i32 i = begin; i < end; i++) {
+    CachedPair &cached = cachedPairs[i];
+    const Body *bodyA = &bodies[cached.pair.a];
+    const Body *bodyB = &bodies[cached.pair.b];
+
+    // The gap can only have shrunk by as much as the bodies moved. If it is
+    // still wider than they can travel this step they cannot touch, which
+    // skips the test for pairs that are close but at rest
+    cached.separation -=
+        m_BodyMotion[cached.pair.a] + m_BodyMotion[cached.pair.b];
+    const f32 reach = (glm::length(bodyA->linearVelocity) +
+                       glm::length(bodyB->linearVelocity)) *
+                          dt_Sec +
+                      kSeparationTolerance;
+    if (cached.separation > reach) {
       continue;
     }
-    Contact contact;
-    if (Intersect(bodyA, bodyB, dt_Sec, contact)) {
-      m_pTempContacts[numContacts] = contact;
-      numContacts++;
+    // Pairs whose manifold survived the refresh already have their points
+    if (m_IterativeSolver &&
+        m_ContactManifolds.Find(cached.pair.a, cached.pair.b)) {
+      cached.separation = 0.f;
+      chunk.numCarried++;
+      continue;
     }
+    chunk.pairs.push_back(cached.pair);
+    chunk.cacheIndices.push_back(i);
   }
-  HELIX_PROFILER_ZONE_END()
 
-  // Sort the times of impact from first to last
-  if (numContacts > 1) {
-    HELIX_PROFILER_ZONE("Sort TOI", HELIX_PROFILER_COLOR_BARRIER)
-    qsort(m_pTempContacts, numContacts, sizeof(Contact), CompareContacts);
-    HELIX_PROFILER_ZONE_END()
+  // Test the remaining pairs in batches, then build contacts for the hits
+  const i32 numTested = (i32)chunk.pairs.size();
+  SphereSphereDynamicBatch(bodies.data(), chunk.pairs.data(), numTested,
+                           dt_Sec, chunk.results);
+  for (i32 i = 0; i < numTested; i++) {
+    cachedPairs[chunk.cacheIndices[i]].separation =
+        chunk.results.separations[i];
   }
+  const i32 numHits = (i32)chunk.results.hits.size();
+  contacts.resize(numHits);
+  for (i32 i = 0; i < numHits; i++) {
+    const i32 tested = chunk.results.hits[i];
+    cachedPairs[chunk.cacheIndices[tested]].separation = 0.f;
+
+    Contact &contact = contacts[i];
+    contact.bodyA = &bodies[chunk.pairs[tested].a];
+    contact.bodyB = &bodies[chunk.pairs[tested].b];
+    contact.timeOfImpact = chunk.results.toi[i];
+    SphereContactPoints(contact.bodyA->transform.GetScale().x,
+                        contact.bodyB->transform.GetScale().x,
+                        contact.bodyA->transform.GetPosition(),
+                        contact.bodyB->transform.GetPosition(),
+                        contact.bodyA->linearVelocity,
+                        contact.bodyB->linearVelocity, contact.timeOfImpact,
+                        contact.ptOnA_WorldSpace, contact.ptOnB_WorldSpace);
+    FinishContact(contact);
+  }
+}
+
+void SceneGraph::SyncSpatialQuery() {
+  m_SpatialQuery.Update(bodies.data(), (i32)bodies.size());
+}
 
-  // Apply ballistic impulses
-  float accumulatedTime = 0.0f;
-  HELIX_PROFILER_ZONE("Apply Ballistic Impulses", HELIX_PROFILER_COLOR_BARRIER)
-  for (int i = 0; i < numContacts; i++) {
-    Contact &contact = m_pTempContacts[i];
-    const float dt = contact.timeOfImpact - accumulatedTime;
-    // Position update
-    HELIX_PROFILER_ZONE("Apply Ballistic Impulses::Update Bodies", 0xffa500)
-    for (int j = 0; j < bodies.size(); j++) {
-      bodies[j].Update(dt);
+void SceneGraph::MarkStaticBodiesDirty() {
+  m_StaticBroadPhase.MarkDirty();
+  m_SphereContactSweep.MarkStaticDirty();
+}
+
+void SceneGraph::BenchmarkRayBatch(const Vec3 &origin) {
+  HELIX_PROFILER_FUNCTION_COLOR();
+  // 512 azimuth steps per scanline, 256 scanlines from 60 degrees below the
+  // horizon to 60 degrees above
+  constexpr i32 kColumns = 512;
+  constexpr i32 kRows = 256;
+  constexpr i32 kNumRays = kColumns * kRows;
+  constexpr i32 kIterations = 10;
+  constexpr f32 kMaxDistance = 1000.f;
+  std::vector<Vec3> rayStarts(kNumRays, origin);
+  std::vector<Vec3> rayDirs(kNumRays);
+  std::vector<f32> hitT(kNumRays);
+  std::vector<i32> hitIds(kNumRays);
+  for (i32 row = 0; row < kRows; row++) {
+    const f32 elevation = glm::radians(-60.f + 120.f * row / (kRows - 1));
+    for (i32 column = 0; column < kColumns; column++) {
+      const f32 azimuth = glm::radians(360.f * column / kColumns);
+      rayDirs[row * kColumns + column] =
+          Vec3(cosf(elevation) * cosf(azimuth), sinf(elevation),
+               cosf(elevation) * sinf(azimuth));
     }
-    HELIX_PROFILER_ZONE_END()
-    ResolveContact(contact);
-    accumulatedTime += dt;
   }
-  HELIX_PROFILER_ZONE_END()
 
-  // Update the positions for the rest of this frame’s time
-  const float timeRemaining = dt_Sec - accumulatedTime;
-  if (timeRemaining > 0.0f) {
-    HELIX_PROFILER_ZONE("Update remaining positions",
-                        HELIX_PROFILER_COLOR_BARRIER)
-    for (int i = 0; i < bodies.size(); i++) {
-      bodies[i].Update(timeRemaining);
-    }
-    HELIX_PROFILER_ZONE_END()
+  SyncSpatialQuery();
+  const u64 start = SDL_GetPerformanceCounter();
+  for (i32 i = 0; i < kIterations; i++) {
+    m_SpatialQuery.RayCastBatch(rayStarts.data(), rayDirs.data(), kNumRays,
+                                kMaxDistance, hitT.data(), hitIds.data());
   }
+  const f64 seconds = (f64)(SDL_GetPerformanceCounter() - start) /
+                      (f64)SDL_GetPerformanceFrequency();
+
+  i32 numHits = 0;
+  for (i32 i = 0; i < kNumRays; i++) {
+    numHits += hitIds[i] != -1;
+  }
+  HINFO("SceneGraph: {} rays x {} in {:.2f} ms, {:.2f} million rays/sec, {} "
+        "hits",
+        kNumRays, kIterations, seconds * 1000.0,
+        kNumRays * kIterations / seconds / 1000000.0, numHits);
 }
 
 void SceneGraph::HandleEvents(const SDL_Event *pEvent, SDL_Window *pWindow,
@@ -474,21 +684,15 @@ void SceneGraph::HandleEvents(const SDL_Event *pEvent, SDL_Window *pWindow,
 
       // rayPushConstant.rayPositions[1] =
       //     Vec4(glm::normalize(rayDir) * 40.f + rayOrigin, 1.f);
-      bool intersected = false;
-      f32 closestT = std::numeric_limits<f32>::max();
-      for (size_t i = 0; i < bodies.size(); ++i) {
-        f32 t;
-        Body &body = bodies[i];
-        if (RayIntersectsSphere(rayOrigin, rayDir, body.transform.GetPosition(),
-                                body.transform.GetScale().x, t)) {
-          if (t > 0.f && t < closestT) {
-            m_SelectedObject = i;
-            closestT = t;
-            rayPushConstant.rayPositions[0] = Vec4(rayOrigin, 1.f);
-            rayPushConstant.rayPositions[1] =
-                Vec4(body.transform.GetPosition(), 1.f);
-          }
-        }
+      SyncSpatialQuery();
+      RayHit hit;
+      if (m_SpatialQuery.RayCastClosest(rayOrigin, rayDir,
+                                        std::numeric_limits<f32>::max(),
+                                        hit)) {
+        m_SelectedObject = hit.bodyId;
+        rayPushConstant.rayPositions[0] = Vec4(rayOrigin, 1.f);
+        rayPushConstant.rayPositions[1] =
+            Vec4(bodies[hit.bodyId].transform.GetPosition(), 1.f);
       }
     }
   } break;
@@ -502,6 +706,9 @@ void SceneGraph::AddSphere(Body body) {
   names.push_back(name);
 
   bodies.push_back(body);
+  if (IsStaticBody(&body)) {
+    MarkStaticBodiesDirty();
+  }
 }
 
 void SceneGraph::Render(VkCommandBuffer cb, hlx::Camera &camera) {
@@ -560,6 +767,60 @@ void SceneGraph::Render(VkCommandBuffer cb, hlx::Camera &camera) {
         }
         ImGui::EndMenu();
       }
+      if (ImGui::BeginMenu("Physics")) {
+        if (ImGui::BeginMenu("Broadphase")) {
+          for (u8 i = 0; i < (u8)BroadPhaseMode::Count; ++i) {
+            const BroadPhaseMode mode = (BroadPhaseMode)i;
+            // Auto shows the algorithm it picked next to it
+            const char *pActive =
+                mode == BroadPhaseMode::Auto
+                    ? BroadPhaseModeName(m_BroadPhase.GetActiveMode())
+                    : nullptr;
+            if (ImGui::MenuItem(BroadPhaseModeName(mode), pActive,
+                                m_BroadPhase.GetMode() == mode)) {
+              m_BroadPhase.SetMode(mode);
+            }
+          }
+          ImGui::EndMenu();
+        }
+        if (ImGui::MenuItem("Fuse Sphere Collision", nullptr,
+                            m_FuseSphereCollision)) {
+          m_FuseSphereCollision = !m_FuseSphereCollision;
+          // The cached pairs miss the steps taken by the other path
+          m_PairCache.Clear();
+          m_PreviousPositions.clear();
+        }
+        if (ImGui::MenuItem("Iterative Solver", nullptr, m_IterativeSolver)) {
+          m_IterativeSolver = !m_IterativeSolver;
+          m_ContactManifolds.Clear();
+        }
+        if (m_IterativeSolver) {
+          i32 iterations = m_ContactSolver.GetIterations();
+          if (ImGui::SliderInt("Solver Iterations", &iterations, 1, 50)) {
+            m_ContactSolver.SetIterations(iterations);
+          }
+          bool parallel = m_ContactSolver.IsParallel();
+          if (ImGui::MenuItem("Parallel Solver", nullptr, &parallel)) {
+            m_ContactSolver.SetParallel(parallel);
+          }
+        }
+        bool recording = m_Telemetry.IsRecording();
+        if (ImGui::MenuItem("Record Telemetry", nullptr, &recording)) {
+          m_Telemetry.SetRecording(recording);
+        }
+        if (ImGui::MenuItem("Save Telemetry CSV", nullptr, false,
+                            !m_Telemetry.GetHistory().empty())) {
+          const char *pPath = "BroadPhaseTelemetry.csv";
+          if (m_Telemetry.WriteCSV(pPath)) {
+            HINFO("SceneGraph: wrote {} steps of telemetry to {}",
+                  m_Telemetry.GetHistory().size(), pPath);
+          }
+        }
+        if (ImGui::MenuItem("Benchmark Ray Batch")) {
+          BenchmarkRayBatch(camera.GetPosition());
+        }
+        ImGui::EndMenu();
+      }
       ImGui::EndMenuBar();
     }
     // Tree Nodes //////////////////////////////////////////////////////////////
@@ -1,13 +1,17 @@
 #pragma once
 
 #include "Physics/Body.hpp"
+#include "Physics/AdaptiveBroadPhase.hpp"
+#include "Physics/Broadphase.hpp"
+#include "Physics/BroadPhaseTelemetry.hpp"
+#include "Physics/ContactSolver.hpp"
+#include "Physics/Intersections.hpp"
+#include "Physics/SpatialQuery.hpp"
 #include <Camera.hpp>
 #include <Vulkan/VulkanTypes.hpp>
 #include <string>
 #include <vector>
 
-struct Contact;
-
 struct Vertex {
   Vec3 position;
   Vec3 normal;
@@ -35,12 +39,71 @@ public:
   void AddSphere(Body body);
   void Render(VkCommandBuffer cb, hlx::Camera &camera);
 
+  // Synced at the end of every physics step, call SyncSpatialQuery first after
+  // adding or moving bodies by hand
+  const SpatialQuery &GetSpatialQuery() const { return m_SpatialQuery; }
+  void SyncSpatialQuery();
+  // The static broadphases only rebuild when told to, call this after adding,
+  // moving or removing static bodies by hand
+  void MarkStaticBodiesDirty();
+
+  // Counters of every physics step, turn recording on to keep a history that
+  // can be written out with WriteCSV
+  BroadPhaseTelemetry &GetBroadPhaseTelemetry() { return m_Telemetry; }
+  // Capacity and high water mark of the per-step contact storage
+  const ContactPool &GetContactPool() const { return m_ContactPool; }
+
 public:
   std::vector<std::string> names;
   std::vector<Body> bodies;
 
 private:
-  Contact *m_pTempContacts{nullptr};
+  // Narrowphase buffers of one chunk of cached pairs
+  struct NarrowPhaseChunk {
+    std::vector<CollisionPair> pairs; // Left after the separation test
+    std::vector<i32> cacheIndices;    // Index of each of them in the cache
+    i32 numCarried; // Pairs skipped because their manifold is still touching
+    SweptSphereResults results;
+  };
+  // Time of impact of a contact as a sortable key
+  struct ContactSortKey {
+    u32 key;
+    i32 index; // Into m_ContactPool
+  };
+
+  // Broadphase, pair cache and narrowphase. Adds the contacts to
+  // m_ContactPool
+  void CollidePairs(const f32 dt_Sec, BroadPhaseCounters &counters);
+  // Narrowphase of the cached pairs in [begin, end)
+  void CollideChunk(const i32 begin, const i32 end, const f32 dt_Sec,
+                    NarrowPhaseChunk &chunk, std::vector<Contact> &contacts);
+  // Fills m_ContactOrder with the contact indices from first to last time of
+  // impact
+  void SortContacts(const Contact *contacts, const i32 num);
+  // Moves a body forward to the given time within the step, if it is not
+  // there yet
+  void AdvanceBody(Body *body, const f32 time);
+  // Casts a lidar sweep from origin through RayCastBatch and logs rays/sec
+  void BenchmarkRayBatch(const Vec3 &origin);
+
+private:
+  ContactPool m_ContactPool; // Contacts of the current step
+  // Contact points kept across steps for the ContactSolver
+  ContactManifoldCache m_ContactManifolds;
+  ContactSolver m_ContactSolver;
+  std::vector<ContactSortKey> m_ContactOrder;
+  std::vector<ContactSortKey> m_ContactOrderScratch;
+  std::vector<f32> m_BodyTimes; // Time each body has reached in the step
+  PairCache m_PairCache;
+  std::vector<NarrowPhaseChunk> m_NarrowPhaseChunks;
+  std::vector<std::vector<Contact>> m_NarrowPhaseContacts; // Per chunk
+  std::vector<Vec3> m_PreviousPositions; // Body positions at the last step
+  std::vector<f32> m_BodyMotion;         // Distance moved since the last step
+  AdaptiveBroadPhase m_BroadPhase;
+  StaticBroadPhase m_StaticBroadPhase;
+  SphereContactSweep m_SphereContactSweep;
+  BroadPhaseTelemetry m_Telemetry;
+  SpatialQuery m_SpatialQuery;
   hlx::VulkanPipeline m_SpherePipeline;
   hlx::VulkanPipeline m_RayDebugPipeline;
   VkDescriptorSetLayout m_VkSetLayout;
@@ -53,6 +116,11 @@ private:
   hlx::VulkanBuffer m_IndexBuffer;
   u32 m_IndexCount;
   bool m_SimulatePhysics = false;
+  // Finds contacts with the SphereContactSweep instead of CollidePairs
+  bool m_FuseSphereCollision = false;
+  // Resolves contacts with the ContactSolver instead of one impulse each in
+  // time of impact order
+  bool m_IterativeSolver = false;
 
   u32 m_SelectedObject{UINT32_MAX};
 };